@@ -122,6 +122,16 @@
  */
 #define MAX_HEAP_SIZE (1ull*(1ull<<40)) /* 1 TB */
 
+/*
+ * Address space reserved for mm_mmap regions, next to the heap
+ */
+#define MAX_MAP_SIZE (1ull*(1ull<<40)) /* 1 TB */
+
+/*
+ * Size of the transparent huge pages the heap may be backed with
+ */
+#define HUGE_PAGE_SIZE (2ull*(1ull<<20)) /* 2 MB */
+
 
 /***************** Parameters for looking up reference throughput *********/
 /*
@@ -24,6 +24,7 @@
 #include "mm.h"
 #include "memlib.h"
 #include "fcyc.h"
+#include "clock.h"
 #include "config.h"
 #include "stree.h"
 
@@ -35,6 +36,9 @@
 #define MAXLINE     1024          /* max string size */
 #define HDRLINES       4          /* number of header lines in a trace file */
 #define LINENUM(i) (i+HDRLINES+1) /* cnvt trace request nums to linenums (origin 1) */
+#define MESH_INTERVAL 1000        /* ops between mm_mesh calls and physical page samples */
+#define REALLOC_BENCH_REPS 5      /* runs of each move in mdriver -R, the fastest counts */
+#define OS_COMMIT_CHUNK 65536     /* heap commit chunk of -F without -C */
 
 #ifndef REF_ONLY
 #define REF_ONLY 0
@@ -80,9 +84,11 @@ typedef struct {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
+    enum { ALLOC, FREE, REALLOC, MEMALIGN, HINT } type; /* type of request */
     long index;                         /* index for free() to use later */
     size_t size;                        /* byte size of alloc/realloc request */
+    size_t align;                       /* alignment of memalign request */
+    int hint;                           /* MM_HINT_* flags of hinted malloc request */
 } traceop_t;
 
 /* Holds the information for one trace file */
@@ -95,6 +101,8 @@ typedef struct {
     traceop_t *ops;       /* array of requests */
     char **blocks;        /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes;  /* ... and a corresponding array of payload sizes */
+    size_t *block_aligns; /* alignment of blocks from memalign, 0 for the others */
+    int *block_hints;     /* MM_HINT_* flags of blocks from hinted mallocs, 0 for the others */
     int *block_rand_base; /* index into random_data, if debug is on */
 } trace_t;
 
@@ -120,6 +128,24 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;       /* space utilization for this trace (always 0 for libc) */
+    double pages;      /* peak physical pages backing the heap (always 0 for libc) */
+    double hot_pages;  /* peak pages holding live MM_HINT_HOT blocks (0 if none) */
+    double sbrks;      /* mm_sbrk calls during the utilization run (always 0 for libc) */
+    size_t probe_max;  /* most free blocks one malloc inspected during the speed run */
+    size_t probe_p99;  /* 99th percentile of the same */
+
+    /* defined only in OS-backed mode (-C, -F) */
+    mem_os_stats_t util_os;   /* kernel work during the utilization run */
+    mem_os_stats_t speed_os;  /* kernel work during all the speed runs */
+
+    /* defined only with -G */
+    double huge_secs;  /* secs needed to run the trace on a heap backed by huge pages */
+
+#ifdef MM_STATS
+    /* defined only in builds with MM_STATS (make stats), for the utilization run */
+    mm_stats_t heap_peak;  /* mm_stats where the most bytes were live */
+    mm_stats_t heap_end;   /* mm_stats after the last request */
+#endif
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -159,6 +185,14 @@ int verbose = REF_ONLY ? 0 : 1;  /* global flag for verbose output */
 static int errors = 0;           /* number of errs found when running student malloc */
 static bool onetime_flag = false;
 static bool tab_mode = false;     /* Print output as tab-separated fields */
+static bool mesh_mode = false;    /* File-backed heap, mm_mesh every MESH_INTERVAL ops */
+static size_t probe_limit = 0;    /* Free blocks one mm_malloc may inspect, 0 = no bound */
+static bool sized_free = false;   /* Free with mm_free_sized / mm_free_aligned_sized */
+static bool no_hints = false;     /* Run hinted mallocs through plain mm_malloc */
+static bool realloc_bench = false; /* Time large reallocs by copy and by mremap, then exit */
+static size_t commit_chunk = 0;   /* OS-backed heap committed in chunks of this size, 0 = off */
+static bool prefault = false;     /* Commit OS-backed memory with MAP_POPULATE */
+static bool huge_compare = false; /* Time each trace again with huge pages */
 static size_t maxfill = MAXFILL;
 
 /* by default, no timeouts */
@@ -184,6 +218,12 @@ static sum_stats_t global_mm_sum_stats;
 
 /* Performance statistics for driver */
 
+#ifdef MM_STATS
+/* mm_stats of the last utilization run, see stats_t */
+static mm_stats_t util_heap_peak;
+static mm_stats_t util_heap_end;
+#endif
+
 /*********************
  * Function prototypes
  *********************/
@@ -216,11 +256,20 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, double *pages,
+                           double *hot_pages);
 static void eval_mm_speed(void *ptr);
 
+/* large realloc benchmark */
+static void run_realloc_bench(void);
+
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void print_os_results(int n, stats_t *stats);
+static void print_huge_results(int n, stats_t *stats);
+#ifdef MM_STATS
+static void print_heap_stats(int n, stats_t *stats);
+#endif
 static void usage(char *prog);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -282,11 +331,32 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         if (mm_stats[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            mem_os_reset_stats();
+            mm_stats[i].util = eval_mm_util(trace, i, &mm_stats[i].pages,
+                                            &mm_stats[i].hot_pages);
+            mem_os_stats(&mm_stats[i].util_os);
+            mm_stats[i].sbrks = mem_sbrk_calls();
+#ifdef MM_STATS
+            mm_stats[i].heap_peak = util_heap_peak;
+            mm_stats[i].heap_end = util_heap_end;
+#endif
             speed_params->trace = trace;
             if (verbose > 1)
                 printf("and performance.\n");
+            mem_os_reset_stats();
             mm_stats[i].secs = fsec(eval_mm_speed, speed_params);
+            mem_os_stats(&mm_stats[i].speed_os);
+            mm_probe_stats(&mm_stats[i].probe_max, &mm_stats[i].probe_p99);
+            if (huge_compare) {
+                /* once more on a fresh memory system with huge pages */
+                mem_deinit();
+                mem_set_huge_pages(true);
+                mem_init();
+                mm_stats[i].huge_secs = fsec(eval_mm_speed, speed_params);
+                mem_deinit();
+                mem_set_huge_pages(false);
+                mem_init();
+            }
         }
 
 #if 0
@@ -356,7 +426,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hOVlDT")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hOVlDTMP:SHRC:FG")) != EOF) {
         switch (c) {
 
             case 'f': /* Use one specific trace file only (relative to curr dir) */
@@ -406,6 +476,42 @@ int main(int argc, char **argv)
                 tab_mode = true;
                 break;
 
+            case 'M':
+                mesh_mode = true;
+                break;
+
+            case 'P':
+                probe_limit = atoi(optarg);
+                break;
+
+            case 'S':
+                sized_free = true;
+                break;
+
+            case 'H':
+                no_hints = true;
+                break;
+
+            case 'R':
+                realloc_bench = true;
+                break;
+
+            case 'C':
+                commit_chunk = strtoul(optarg, NULL, 0);
+                if (commit_chunk == 0) {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+
+            case 'F':
+                prefault = true;
+                break;
+
+            case 'G':
+                huge_compare = true;
+                break;
+
             case 'h': /* Print this message */
                 usage(argv[0]);
                 exit(0);
@@ -427,6 +533,25 @@ int main(int argc, char **argv)
         init_random_data();
     }
 
+    if (prefault && commit_chunk == 0)
+        commit_chunk = OS_COMMIT_CHUNK;
+    if (commit_chunk != 0 && mesh_mode) {
+        fprintf(stderr, "OS-backed mode (-C, -F) doesn't work with mesh mode (-M)\n");
+        exit(1);
+    }
+    if (huge_compare && mesh_mode) {
+        fprintf(stderr, "Huge pages (-G) don't work with mesh mode (-M)\n");
+        exit(1);
+    }
+    mem_set_file_backed(mesh_mode);
+    mem_set_os_backed(commit_chunk, prefault);
+    mm_set_probe_limit(probe_limit);
+
+    if (realloc_bench) {
+        run_realloc_bench();
+        exit(0);
+    }
+
     /* Initialize the timeout */
     if (set_timeout > 0) {
         signal(SIGALRM, timeout_handler);
@@ -518,6 +643,23 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_global_tracefiles, mm_stats, &global_mm_sum_stats);
             printf("\n");
+            if (commit_chunk != 0) {
+                printf("Kernel work in OS-backed mode (%zu-byte commits%s):\n",
+                       commit_chunk, prefault ? ", prefaulted" : "");
+                print_os_results(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (huge_compare) {
+                printf("Throughput with %zu KiB pages and %llu KiB huge pages:\n",
+                       mm_pagesize() / 1024, HUGE_PAGE_SIZE / 1024);
+                print_huge_results(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+#ifdef MM_STATS
+            printf("Allocator statistics (bytes at the sample with the most live bytes, counts over the whole run):\n");
+            print_heap_stats(num_global_tracefiles, mm_stats);
+            printf("\n");
+#endif
         }
     }
 
@@ -712,9 +854,11 @@ static bool add_range(range_set_t *ranges, char *lo, size_t size,
         return false;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or of one
+       region from mm_mmap */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+         (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+        !mem_in_mapping(lo, hi)) {
         malloc_error(trace, opnum,
                      "Payload (%p:%p) lies outside heap (%p:%p)",
                      lo, hi, mem_heap_lo(), mem_heap_hi());
@@ -964,7 +1108,7 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
 
     /* We'll store each request line in the trace in this array */
     if ((trace->ops =
-         (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+         (traceop_t *)calloc(trace->num_ops, sizeof(traceop_t))) == NULL)
         unix_error("malloc 2 failed in read_trace");
 
     /* We'll keep an array of pointers to the allocated blocks here... */
@@ -977,10 +1121,20 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
          (size_t *)calloc(trace->num_ids,  sizeof(size_t))) == NULL)
         unix_error("malloc 4 failed in read_trace");
 
+    /* ... and alignments, for sized frees of memalign blocks */
+    if ((trace->block_aligns =
+         (size_t *)calloc(trace->num_ids,  sizeof(size_t))) == NULL)
+        unix_error("malloc 5 failed in read_trace");
+
+    /* ... and placement hints, for measuring the locality of hot blocks */
+    if ((trace->block_hints =
+         (int *)calloc(trace->num_ids,  sizeof(int))) == NULL)
+        unix_error("malloc 6 failed in read_trace");
+
     /* and, if we're debugging, the offset into the random data */
     if ((trace->block_rand_base =
          calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
-        unix_error("malloc 5 failed in read_trace");
+        unix_error("malloc 7 failed in read_trace");
 
 
     /* read every request line in the trace file */
@@ -1002,6 +1156,22 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
                 trace->ops[op_index].size = size;
                 max_index = (index > max_index) ? index : max_index;
                 break;
+            case 'm':
+                ignore += fscanf(tracefile, "%u %lu %lu", &index, &size,
+                                 &trace->ops[op_index].align);
+                trace->ops[op_index].type = MEMALIGN;
+                trace->ops[op_index].index = index;
+                trace->ops[op_index].size = size;
+                max_index = (index > max_index) ? index : max_index;
+                break;
+            case 'h':
+                ignore += fscanf(tracefile, "%u %lu %d", &index, &size,
+                                 &trace->ops[op_index].hint);
+                trace->ops[op_index].type = HINT;
+                trace->ops[op_index].index = index;
+                trace->ops[op_index].size = size;
+                max_index = (index > max_index) ? index : max_index;
+                break;
             case 'f':
                 ignore += fscanf(tracefile, "%u", &index);
                 trace->ops[op_index].type = FREE;
@@ -1033,6 +1203,8 @@ static void reinit_trace(trace_t *trace)
 {
     memset(trace->blocks, 0, trace->num_ids * sizeof(*trace->blocks));
     memset(trace->block_sizes, 0, trace->num_ids * sizeof(*trace->block_sizes));
+    memset(trace->block_aligns, 0, trace->num_ids * sizeof(*trace->block_aligns));
+    memset(trace->block_hints, 0, trace->num_ids * sizeof(*trace->block_hints));
     /* block_rand_base is unused if size is zero */
 }
 
@@ -1045,6 +1217,8 @@ static void free_trace(trace_t *trace)
     free(trace->ops);         /* free the three arrays... */
     free(trace->blocks);
     free(trace->block_sizes);
+    free(trace->block_aligns);
+    free(trace->block_hints);
     free(trace->block_rand_base);
     free(trace);              /* and the trace record itself... */
 }
@@ -1054,6 +1228,64 @@ static void free_trace(trace_t *trace)
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * free_block - Frees block index of the trace (NULL if index is -1),
+ *     through the sized entry points if sized frees were asked for
+ */
+static void free_block(trace_t *trace, int index)
+{
+    char *p = (index < 0) ? NULL : trace->blocks[index];
+
+    if (!sized_free || p == NULL)
+        mm_free(p);
+    else if (trace->block_aligns[index] != 0)
+        mm_free_aligned_sized(p, trace->block_aligns[index],
+                              trace->block_sizes[index]);
+    else
+        mm_free_sized(p, trace->block_sizes[index]);
+    if (index >= 0)
+        trace->block_hints[index] = 0;
+}
+
+/*
+ * hot_pages - Number of distinct pages holding live blocks that were
+ *     allocated with MM_HINT_HOT
+ */
+static int compare_pages(const void *a, const void *b)
+{
+    uintptr_t x = *(const uintptr_t *)a;
+    uintptr_t y = *(const uintptr_t *)b;
+    return (x > y) - (x < y);
+}
+
+static size_t hot_pages(trace_t *trace)
+{
+    size_t n = 0, cap = 0, distinct = 0;
+    uintptr_t *pages = NULL;
+    int i;
+
+    for (i = 0; i < trace->num_ids; i++) {
+        if (!(trace->block_hints[i] & MM_HINT_HOT) || trace->block_sizes[i] == 0)
+            continue;
+        uintptr_t lo = (uintptr_t)trace->blocks[i] / mem_pagesize();
+        uintptr_t hi = ((uintptr_t)trace->blocks[i] + trace->block_sizes[i] - 1)
+                       / mem_pagesize();
+        for (; lo <= hi; lo++) {
+            if (n == cap) {
+                cap = cap ? 2 * cap : 256;
+                if ((pages = realloc(pages, cap * sizeof(*pages))) == NULL)
+                    unix_error("realloc failed in hot_pages");
+            }
+            pages[n++] = lo;
+        }
+    }
+    qsort(pages, n, sizeof(*pages), compare_pages);
+    for (i = 0; i < (int)n; i++)
+        distinct += (i == 0 || pages[i] != pages[i - 1]);
+    free(pages);
+    return distinct;
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
@@ -1100,12 +1332,19 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
             }
         }
 
+        if (mesh_mode && i % MESH_INTERVAL == 0) {
+            mm_mesh();
+        }
+
         switch (trace->ops[i].type) {
 
             case ALLOC: /* mm_malloc */
+            case HINT:  /* mm_malloc_hint */
 
                 /* Call the student's malloc */
-                if ((p = mm_malloc(size)) == NULL) {
+                p = (trace->ops[i].type == HINT && !no_hints)
+                    ? mm_malloc_hint(size, trace->ops[i].hint) : mm_malloc(size);
+                if (p == NULL) {
                     malloc_error(trace, i, "mm_malloc failed.");
                     return false;
                 }
@@ -1121,11 +1360,33 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
                 /* Remember region */
                 trace->blocks[index] = p;
                 trace->block_sizes[index] = size;
+                trace->block_aligns[index] = 0;
+                trace->block_hints[index] = trace->ops[i].hint;
 
                 /* Set to random data, for debugging. */
                 randomize_block(trace, index);
                 break;
 
+            case MEMALIGN: /* mm_memalign */
+
+                if ((p = mm_memalign(trace->ops[i].align, size)) == NULL) {
+                    malloc_error(trace, i, "mm_memalign failed.");
+                    return false;
+                }
+                if ((unsigned long)p % trace->ops[i].align != 0) {
+                    malloc_error(trace, i, "Payload address (%p) not aligned to %zu bytes",
+                                 p, trace->ops[i].align);
+                    return false;
+                }
+                if (add_range(ranges, p, size, trace, i, index) == 0)
+                    return false;
+
+                trace->blocks[index] = p;
+                trace->block_sizes[index] = size;
+                trace->block_aligns[index] = trace->ops[i].align;
+                randomize_block(trace, index);
+                break;
+
             case REALLOC: /* mm_realloc */
                 if (!check_index(trace, i, index, 0))
                     return false;
@@ -1164,6 +1425,7 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
                 if (!check_index(trace, i, index, 1))
                     return false;
                 trace->block_sizes[index] = size;
+                trace->block_aligns[index] = 0;
 
                 /* Set to random data, for debugging. */
                 randomize_block(trace, index);
@@ -1180,7 +1442,7 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
                     p = trace->blocks[index];
                     remove_range(ranges, p);
                 }
-                mm_free(p);
+                free_block(trace, index);
                 break;
 
             default:
@@ -1202,8 +1464,15 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
  *   is always the high water mark of the heap.
  *
  *   A higher number is better: 1 is optimal.
+ *
+ *   The peak number of physical pages behind the heap, sampled every
+ *   MESH_INTERVAL operations, is stored in *pages, and the peak number
+ *   of pages holding live MM_HINT_HOT blocks, sampled alike, in *hot.
+ *   With MM_STATS, mm_stats is sampled alike too: the sample with the
+ *   most live bytes goes to util_heap_peak, the final one to util_heap_end.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, double *pages,
+                           double *hot)
 {
     int i;
     int index;
@@ -1212,6 +1481,8 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     size_t total_size = 0;
     size_t max_heap_size = 0;
     size_t heap_size = 0;
+    size_t max_pages = 0;
+    size_t max_hot = 0;
     char *p;
     char *newp, *oldp;
 
@@ -1221,15 +1492,35 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     mem_reset_brk();
     if (!mm_init())
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
+#ifdef MM_STATS
+    memset(&util_heap_peak, 0, sizeof(util_heap_peak));
+#endif
 
     for (i = 0;  i < trace->num_ops;  i++) {
+        if (i % MESH_INTERVAL == 0) {
+            if (mesh_mode)
+                mm_mesh();
+            size_t phys_pages = mem_phys_pages();
+            max_pages = (phys_pages > max_pages) ? phys_pages : max_pages;
+            size_t live_hot = hot_pages(trace);
+            max_hot = (live_hot > max_hot) ? live_hot : max_hot;
+#ifdef MM_STATS
+            mm_stats(&util_heap_end);
+            if (util_heap_end.live_bytes >= util_heap_peak.live_bytes)
+                util_heap_peak = util_heap_end;
+#endif
+        }
+
         switch (trace->ops[i].type) {
 
             case ALLOC: /* mm_alloc */
+            case HINT:  /* mm_malloc_hint */
                 index = trace->ops[i].index;
                 size = trace->ops[i].size;
 
-                if ((p = mm_malloc(size)) == NULL) {
+                p = (trace->ops[i].type == HINT && !no_hints)
+                    ? mm_malloc_hint(size, trace->ops[i].hint) : mm_malloc(size);
+                if (p == NULL) {
                     app_error("trace %d: mm_malloc failed in eval_mm_util",
                               tracenum);
                 }
@@ -1237,6 +1528,24 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 /* Remember region and size */
                 trace->blocks[index] = p;
                 trace->block_sizes[index] = size;
+                trace->block_aligns[index] = 0;
+                trace->block_hints[index] = trace->ops[i].hint;
+
+                total_size += size;
+                break;
+
+            case MEMALIGN: /* mm_memalign */
+                index = trace->ops[i].index;
+                size = trace->ops[i].size;
+
+                if ((p = mm_memalign(trace->ops[i].align, size)) == NULL) {
+                    app_error("trace %d: mm_memalign failed in eval_mm_util",
+                              tracenum);
+                }
+
+                trace->blocks[index] = p;
+                trace->block_sizes[index] = size;
+                trace->block_aligns[index] = trace->ops[i].align;
 
                 total_size += size;
                 break;
@@ -1255,6 +1564,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 /* Remember region and size */
                 trace->blocks[index] = newp;
                 trace->block_sizes[index] = newsize;
+                trace->block_aligns[index] = 0;
 
                 total_size += (newsize - oldsize);
                 break;
@@ -1269,7 +1579,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                     p = trace->blocks[index];
                 }
 
-                mm_free(p);
+                free_block(trace, index);
 
                 total_size -= size;
                 break;
@@ -1282,15 +1592,23 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         /* update the high-water mark */
         max_total_size = (total_size > max_total_size) ?
             total_size : max_total_size;
-        heap_size = mem_heapsize();
+        heap_size = mem_heapsize() + mem_mapped_bytes();
         max_heap_size = (heap_size > max_heap_size) ?
             heap_size : max_heap_size;
     }
 
+#ifdef MM_STATS
+    mm_stats(&util_heap_end);
+    if (util_heap_end.live_bytes >= util_heap_peak.live_bytes)
+        util_heap_peak = util_heap_end;
+#endif
+
 #if !REF_ONLY
     printf(".");
 #endif
 
+    *pages = (double)max_pages;
+    *hot = (double)max_hot;
     return ((double)max_total_size / (double)max_heap_size);
 }
 
@@ -1303,7 +1621,7 @@ static void eval_mm_speed(void *ptr)
 {
     int i, index;
     size_t size, newsize;
-    char *p, *newp, *oldp, *block;
+    char *p, *newp, *oldp;
     trace_t *trace = ((speed_t *)ptr)->trace;
     reinit_trace(trace);
 
@@ -1317,11 +1635,30 @@ static void eval_mm_speed(void *ptr)
         switch (trace->ops[i].type) {
 
             case ALLOC: /* mm_malloc */
+            case HINT:  /* mm_malloc_hint */
                 index = trace->ops[i].index;
                 size = trace->ops[i].size;
-                if ((p = mm_malloc(size)) == NULL)
+                p = (trace->ops[i].type == HINT && !no_hints)
+                    ? mm_malloc_hint(size, trace->ops[i].hint) : mm_malloc(size);
+                if (p == NULL)
                     app_error("mm_malloc error in eval_mm_speed");
                 trace->blocks[index] = p;
+                if (sized_free) {
+                    trace->block_sizes[index] = size;
+                    trace->block_aligns[index] = 0;
+                }
+                break;
+
+            case MEMALIGN: /* mm_memalign */
+                index = trace->ops[i].index;
+                size = trace->ops[i].size;
+                if ((p = mm_memalign(trace->ops[i].align, size)) == NULL)
+                    app_error("mm_memalign error in eval_mm_speed");
+                trace->blocks[index] = p;
+                if (sized_free) {
+                    trace->block_sizes[index] = size;
+                    trace->block_aligns[index] = trace->ops[i].align;
+                }
                 break;
 
             case REALLOC: /* mm_realloc */
@@ -1331,16 +1668,14 @@ static void eval_mm_speed(void *ptr)
                 if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
                     app_error("mm_realloc error in eval_mm_speed");
                 trace->blocks[index] = newp;
+                if (sized_free) {
+                    trace->block_sizes[index] = newsize;
+                    trace->block_aligns[index] = 0;
+                }
                 break;
 
             case FREE: /* mm_free */
-                index = trace->ops[i].index;
-                if (index < 0) {
-                    block = 0;
-                } else {
-                    block = trace->blocks[index];
-                }
-                mm_free(block);
+                free_block(trace, trace->ops[i].index);
                 break;
 
             default:
@@ -1348,6 +1683,76 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * time_move - returns the seconds it takes to grow a block of size bytes
+ *    to twice that, the way realloc's copy path does (map a new block,
+ *    copy, unmap the old one) or with mremap. A guard mapping right
+ *    behind the block forces mremap to move it, as in a busy mapping area.
+ */
+static double time_move(size_t size, bool by_mremap)
+{
+    size_t page = getpagesize();
+    char *block = mm_mmap(size);    /* first fit in an empty area: the block */
+    char *guard = mm_mmap(page);    /* comes first and the guard right behind it */
+    char *moved;
+    double secs;
+
+    if (block == NULL || guard == NULL)
+        unix_error("mm_mmap failed in time_move");
+    mm_memset(block, 0x5a, size);   /* the pages must be present */
+
+    start_timer();
+    if (by_mremap) {
+        moved = mm_mremap(block, size, 2 * size, true);
+    } else {
+        if ((moved = mm_mmap(2 * size)) != NULL) {
+            mm_memcpy(moved, block, size);
+            mm_munmap(block, size);
+        }
+    }
+    secs = get_timer();
+
+    if (moved == NULL)
+        unix_error("moving the block failed in time_move");
+    mm_munmap(moved, 2 * size);
+    mm_munmap(guard, page);
+    return secs;
+}
+
+/*
+ * run_realloc_bench - times growing blocks from 4 KiB to 256 MiB to
+ *    twice their size by copying and by mremap, taking the best of
+ *    REALLOC_BENCH_REPS runs, and reports the smallest size from which
+ *    mremap wins
+ */
+static void run_realloc_bench(void)
+{
+    size_t size;
+    size_t crossover = 0;
+    int rep;
+
+    mem_init();
+    printf("%10s %12s %12s %8s\n", "bytes", "copy usecs", "mremap usecs", "speedup");
+    for (size = 4 * 1024; size <= 256 * 1024 * 1024; size *= 2) {
+        double copy = DBL_MAX, remap = DBL_MAX;
+        for (rep = 0; rep < REALLOC_BENCH_REPS; rep++) {
+            copy = fmin(copy, time_move(size, false) * 1e6);
+            remap = fmin(remap, time_move(size, true) * 1e6);
+        }
+
+        printf("%10zu %12.1f %12.1f %8.2f\n", size, copy, remap, copy / remap);
+        if (remap < copy && crossover == 0)
+            crossover = size;
+        else if (remap >= copy)
+            crossover = 0;
+    }
+    if (crossover != 0)
+        printf("mremap is faster from %zu bytes up\n", crossover);
+    else
+        printf("mremap is not faster at any size tested\n");
+    mem_deinit();
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1366,6 +1771,7 @@ static bool eval_libc_valid(trace_t *trace)
         switch (trace->ops[i].type) {
 
             case ALLOC: /* malloc */
+            case HINT:  /* libc has no hints */
                 if ((p = malloc(trace->ops[i].size)) == NULL) {
                     malloc_error(trace, i, "libc malloc failed");
                     unix_error("System message");
@@ -1373,6 +1779,15 @@ static bool eval_libc_valid(trace_t *trace)
                 trace->blocks[trace->ops[i].index] = p;
                 break;
 
+            case MEMALIGN: /* posix_memalign */
+                if (posix_memalign((void **)&p, trace->ops[i].align,
+                                   trace->ops[i].size) != 0) {
+                    malloc_error(trace, i, "libc posix_memalign failed");
+                    unix_error("System message");
+                }
+                trace->blocks[trace->ops[i].index] = p;
+                break;
+
             case REALLOC: /* realloc */
                 newsize = trace->ops[i].size;
                 oldp = trace->blocks[trace->ops[i].index];
@@ -1417,6 +1832,7 @@ static void eval_libc_speed(void *ptr)
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
             case ALLOC: /* malloc */
+            case HINT:  /* libc has no hints */
                 index = trace->ops[i].index;
                 size = trace->ops[i].size;
                 if ((p = malloc(size)) == NULL)
@@ -1424,6 +1840,14 @@ static void eval_libc_speed(void *ptr)
                 trace->blocks[index] = p;
                 break;
 
+            case MEMALIGN: /* posix_memalign */
+                index = trace->ops[i].index;
+                size = trace->ops[i].size;
+                if (posix_memalign((void **)&p, trace->ops[i].align, size) != 0)
+                    unix_error("posix_memalign failed in eval_libc_speed");
+                trace->blocks[index] = p;
+                break;
+
             case REALLOC: /* realloc */
                 index = trace->ops[i].index;
                 newsize = trace->ops[i].size;
@@ -1472,10 +1896,10 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
 
     /* Print the individual results for each trace */
     if (tab_mode) {
-        printf("valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\ttrace\n");
+        printf("valid\tthru?\tutil?\tutil\tpages\thot\tsbrks\tops\tmsecs\tKops\tp99\tmax\ttrace\n");
     } else {
-        printf("  %5s  %6s %7s%8s%8s  %s\n",
-               "valid", "util", "ops", "msecs", "Kops", "trace");
+        printf("  %5s  %6s %7s %5s %6s %7s%8s%8s %9s  %s\n",
+               "valid", "util", "pages", "hot", "sbrks", "ops", "msecs", "Kops", "probes", "trace");
     }
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
@@ -1523,6 +1947,36 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
                     printf(" %8s", "--");
             }
 
+            /* Physical pages */
+            if (tab_mode) {
+                printf("%.0f\t", stats[i].pages);
+            } else {
+                if (stats[i].pages > 0)
+                    printf("%8.0f", stats[i].pages);
+                else
+                    printf("%8s", "--");
+            }
+
+            /* Pages holding live hot-hinted blocks */
+            if (tab_mode) {
+                printf("%.0f\t", stats[i].hot_pages);
+            } else {
+                if (stats[i].hot_pages > 0)
+                    printf("%6.0f", stats[i].hot_pages);
+                else
+                    printf("%6s", "--");
+            }
+
+            /* Heap extensions */
+            if (tab_mode) {
+                printf("%.0f\t", stats[i].sbrks);
+            } else {
+                if (stats[i].sbrks > 0)
+                    printf("%7.0f", stats[i].sbrks);
+                else
+                    printf("%7s", "--");
+            }
+
             /* Ops + Time */
             double msecs = stats[i].secs * 1000.0;
             double kops = (stats[i].ops*1e-3)/stats[i].secs;
@@ -1538,6 +1992,19 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
                     printf("%8s%10s%7s ", "--", "--", "--");
             }
 
+            /* Free blocks inspected per malloc, 99th percentile / maximum */
+            if (tab_mode) {
+                printf("%zu\t%zu\t", stats[i].probe_p99, stats[i].probe_max);
+            } else {
+                if (stats[i].probe_max > 0) {
+                    char probes[32];
+                    snprintf(probes, sizeof(probes), "%zu/%zu", stats[i].probe_p99, stats[i].probe_max);
+                    printf("%9s ", probes);
+                }
+                else
+                    printf("%9s ", "--");
+            }
+
             printf("%s\n", stats[i].filename);
 
             if (stats[i].weight == WALL || stats[i].weight == WPERF)
@@ -1554,15 +2021,19 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
         }
         else {
             if (tab_mode) {
-                printf("no\t\t\t\t\t\t\t%s\n", stats[i].filename);
+                printf("no\t\t\t\t\t\t\t\t\t\t\t\t%s\n", stats[i].filename);
             } else {
-                printf("%2s%4s%7s%10s%7s%10s %s\n",
+                printf("%2s%4s%7s%8s%6s%7s%10s%7s%10s%10s %s\n",
                        stats[i].weight != 0 ? "*" : "",
                        "no",
                        "-",
                        "-",
                        "-",
                        "-",
+                       "-",
+                       "-",
+                       "-",
+                       "-",
                        stats[i].filename);
             }
         }
@@ -1579,15 +2050,18 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
         double tput = (sumsecs==0.0) ? 0 : (sumops/1e3)/sumsecs;
         if (tab_mode) {
             // "valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\ttrace"
-            printf("Sum\t%d\t%d\t%.1f\t%.0f\t\%.2f\n",
+            printf("Sum\t%d\t%d\t%.1f\t\t\t\t%.0f\t\%.2f\n",
                    sum_perf_weight, sum_util_weight, sumutil*100.0, sumops, sumsecs * 1000.0);
-            printf("Avg\t\t\t%.1f\t\t\t%.0f\n",
+            printf("Avg\t\t\t%.1f\t\t\t\t\t\t%.0f\n",
                    util, tput);
         } else {
-            printf("%2d %2d  %7.1f%%%8.0f%10.3f%7.0f\n",
+            printf("%2d %2d  %7.1f%%%8s%6s%7s%8.0f%10.3f%7.0f\n",
                    sum_util_weight,
                    sum_perf_weight,
                    util,
+                   "",
+                   "",
+                   "",
                    sumops,
                    sumsecs * 1000.0,
                    tput);
@@ -1602,7 +2076,8 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     }
     else {
         if (!tab_mode) {
-            printf("     %8s%10s%7s\n",
+            printf("     %8s%8s%10s%7s\n",
+                   "-",
                    "-",
                    "-",
                    "-");
@@ -1617,6 +2092,169 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     }
 }
 
+/*
+ * print_os_results - prints the kernel work of each valid trace in
+ *     OS-backed mode: system calls, minor faults and peak committed
+ *     memory of the utilization run, and the same plus the CPU time
+ *     split of all the speed runs together
+ */
+static void print_os_results(int n, stats_t *stats)
+{
+    int i;
+
+    if (tab_mode) {
+        printf("usys	ufaults	commitKiB	ssys	sfaults	user	kernel	kernel%%	trace\n");
+    } else {
+        printf("  %-26s  %s\n", "utilization run", "speed runs");
+        printf("  %7s %8s %9s  %7s %8s %7s %7s %7s  %s\n",
+               "syscall", "faults", "commitKiB", "syscall", "faults",
+               "user", "kernel", "kernel", "trace");
+    }
+    for (i = 0; i < n; i++) {
+        mem_os_stats_t *u = &stats[i].util_os;
+        mem_os_stats_t *s = &stats[i].speed_os;
+        double cpu = s->user_secs + s->sys_secs;
+        double sys_pct = (cpu > 0) ? s->sys_secs / cpu * 100.0 : 0;
+
+        if (!stats[i].valid)
+            continue;
+        if (tab_mode) {
+            printf("%zu\t%ld\t%zu\t%zu\t%ld\t%.3f\t%.3f\t%.1f\t%s\n",
+                   u->syscalls, u->minor_faults, u->peak_committed / 1024,
+                   s->syscalls, s->minor_faults, s->user_secs * 1000.0,
+                   s->sys_secs * 1000.0, sys_pct, stats[i].filename);
+        } else {
+            printf("  %7zu %8ld %9zu  %7zu %8ld %5.0fms %5.0fms %6.1f%%  %s\n",
+                   u->syscalls, u->minor_faults, u->peak_committed / 1024,
+                   s->syscalls, s->minor_faults, s->user_secs * 1000.0,
+                   s->sys_secs * 1000.0, sys_pct, stats[i].filename);
+        }
+    }
+}
+
+/*
+ * print_huge_results - prints the throughput of each valid trace with
+ *     ordinary pages and with huge pages (-G)
+ */
+static void print_huge_results(int n, stats_t *stats)
+{
+    int i;
+
+    if (tab_mode) {
+        printf("Kops\thugeKops\tspeedup\ttrace\n");
+    } else {
+        printf("  %8s %8s %8s  %s\n", "Kops", "hugeKops", "speedup", "trace");
+    }
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        double kops = (stats[i].ops * 1e-3) / stats[i].secs;
+        double huge_kops = (stats[i].ops * 1e-3) / stats[i].huge_secs;
+        if (tab_mode) {
+            printf("%.0f\t%.0f\t%.2f\t%s\n", kops, huge_kops,
+                   stats[i].secs / stats[i].huge_secs, stats[i].filename);
+        } else {
+            printf("  %8.0f %8.0f %7.2fx  %s\n", kops, huge_kops,
+                   stats[i].secs / stats[i].huge_secs, stats[i].filename);
+        }
+    }
+}
+
+#ifdef MM_STATS
+/*
+ * print_counts - prints n counters as name:count pairs, skipping zeros;
+ *     names[i] labels counts[i], or the index is used if names is NULL
+ */
+static void print_counts(const size_t *counts, size_t n,
+                         const char *const *names, const char *sep)
+{
+    size_t i;
+    int printed = 0;
+
+    for (i = 0; i < n; i++) {
+        if (counts[i] == 0)
+            continue;
+        if (names != NULL)
+            printf("%s%s:%zu", printed++ ? sep : "", names[i], counts[i]);
+        else
+            printf("%s%zu:%zu", printed++ ? sep : "", i, counts[i]);
+    }
+    if (!printed)
+        printf("-");
+}
+
+/*
+ * print_heap_stats - prints mm_stats for each valid trace: live and
+ *     free bytes and the free blocks per size class at the peak, and
+ *     the probe histogram, sbrk calls, splits, coalesces and reallocs
+ *     over the whole utilization run
+ */
+static void print_heap_stats(int n, stats_t *stats)
+{
+    static const char *const probe_names[MM_STATS_PROBE_BUCKETS] = {
+        "0", "1", "2-3", "4-7", "8-15", "16-31", "32-63", "64-127",
+        "128-255", "256+"
+    };
+    static const char *const split_names[MM_SPLIT_CASES] = {
+        "malloc", "realloc", "expand", "grow"
+    };
+    static const char *const coalesce_names[MM_COALESCE_CASES] = {
+        "none", "left", "right", "both"
+    };
+    static const char *const realloc_names[MM_REALLOC_CASES] = {
+        "inplace", "remapped", "moved"
+    };
+    int i;
+
+    if (tab_mode)
+        printf("liveKiB\tfreeKiB\tfree%%\tclasses\tspans\tprobes\tmaxprobe\tsbrks\tsbrkKiB\tsplits\tcoalesces\treallocs\tcopiedKiB\ttrace\n");
+    for (i = 0; i < n; i++) {
+        mm_stats_t *p = &stats[i].heap_peak;
+        mm_stats_t *e = &stats[i].heap_end;
+        size_t in_use = p->live_bytes + p->free_bytes;
+        double free_pct = in_use ? (double)p->free_bytes / in_use * 100.0 : 0;
+        const char *sep = tab_mode ? "," : " ";
+
+        if (!stats[i].valid)
+            continue;
+        if (tab_mode) {
+            printf("%zu\t%zu\t%.1f\t", p->live_bytes / 1024,
+                   p->free_bytes / 1024, free_pct);
+            print_counts(p->free_blocks, p->classes, NULL, sep);
+            printf("\t%zu\t", p->free_spans);
+            print_counts(e->probes, MM_STATS_PROBE_BUCKETS, probe_names, sep);
+            printf("\t%zu\t%zu\t%zu\t", e->probe_max, e->sbrk_calls,
+                   e->sbrk_bytes / 1024);
+            print_counts(e->splits, MM_SPLIT_CASES, split_names, sep);
+            printf("\t");
+            print_counts(e->coalesces, MM_COALESCE_CASES, coalesce_names, sep);
+            printf("\t");
+            print_counts(e->reallocs, MM_REALLOC_CASES, realloc_names, sep);
+            printf("\t%zu\t%s\n", e->realloc_copied / 1024, stats[i].filename);
+            continue;
+        }
+        printf("  %s\n", stats[i].filename);
+        printf("    peak      %zu KiB live, %zu KiB free (%.1f%%), %zu free spans\n",
+               p->live_bytes / 1024, p->free_bytes / 1024, free_pct,
+               p->free_spans);
+        printf("    classes   ");
+        print_counts(p->free_blocks, p->classes, NULL, sep);
+        printf("\n    probes    ");
+        print_counts(e->probes, MM_STATS_PROBE_BUCKETS, probe_names, sep);
+        printf(" (max %zu, %zu mallocs)\n", e->probe_max, e->mallocs);
+        printf("    sbrk      %zu calls, %zu KiB\n", e->sbrk_calls,
+               e->sbrk_bytes / 1024);
+        printf("    splits    ");
+        print_counts(e->splits, MM_SPLIT_CASES, split_names, sep);
+        printf("\n    coalesces ");
+        print_counts(e->coalesces, MM_COALESCE_CASES, coalesce_names, sep);
+        printf("\n    reallocs  ");
+        print_counts(e->reallocs, MM_REALLOC_CASES, realloc_names, sep);
+        printf(" (%zu KiB copied)\n", e->realloc_copied / 1024);
+    }
+}
+#endif
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1828,7 +2466,7 @@ static double measure_ref_throughput() {
  */
 static void usage(char *prog)
 {
-    fprintf(stderr, "Usage: %s [-hlVdD] [-f <file>]\n", prog);
+    fprintf(stderr, "Usage: %s [-hlVdDMSHRFG] [-P <n>] [-C <bytes>] [-f <file>]\n", prog);
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
     fprintf(stderr, "\t-D         Equivalent to -d2.\n");
@@ -1840,5 +2478,13 @@ static void usage(char *prog)
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-T         Print diagnostics in tab mode\n");
+    fprintf(stderr, "\t-M         Mesh mode: file-backed heap, call mm_mesh periodically\n");
+    fprintf(stderr, "\t-P <n>     Let mm_malloc inspect at most n free blocks in all\n");
+    fprintf(stderr, "\t-S         Free blocks through mm_free_sized\n");
+    fprintf(stderr, "\t-H         Ignore the placement hints of 'h' requests\n");
+    fprintf(stderr, "\t-R         Time large reallocs by copy and by mremap, then exit\n");
+    fprintf(stderr, "\t-C <n>     OS-backed heap: commit memory with mprotect, n bytes at a time\n");
+    fprintf(stderr, "\t-F         Prefault OS-backed memory with MAP_POPULATE (implies -C)\n");
+    fprintf(stderr, "\t-G         Time each trace again on a heap backed by huge pages\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file\n");
 }
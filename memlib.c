@@ -4,6 +4,7 @@
  * package with the system's malloc package in libc.
  *
  */
+#define _GNU_SOURCE /* memfd_create, fallocate */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -14,14 +15,128 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 #include "memlib.h"
 #include "config.h"
 
+#define MEM_SHM_NAME_MAX 255
+#define MEM_FILE_MAGIC 0x31504145484d4d23ull    /* "#MMHEAP1" */
+
+/* An independent heap area with its own break. A shared or file-backed
+ * segment keeps this in the first page of its memory object, where it
+ * is the header of a persistent heap file. */
+struct mem_segment {
+    uint64_t magic;                         /* MEM_FILE_MAGIC in a heap file */
+    uint64_t layout;                        /* Heap file format of the allocator, from mm_segment_open */
+    unsigned char *lo;                      /* Starting address */
+    unsigned char *brk;                     /* Current position of break */
+    unsigned char *fresh;                   /* Highest break so far, never-used memory starts here */
+    unsigned char *max_addr;                /* Maximum allowable address */
+    bool shared;                            /* Mapped by several processes */
+    pthread_mutex_t lock;                   /* Process-shared lock of a shared segment */
+    pid_t creator;                          /* Process that unlinks the shared memory object */
+    char name[MEM_SHM_NAME_MAX + 1];        /* Name of the shared memory object */
+    void *user_root;                        /* Set by mm_segment_set_user_root */
+};
+
+/* A region mapped by mm_mmap, in the mapping area outside the heap */
+typedef struct mem_mapping {
+    unsigned char *addr;
+    size_t len;
+    struct mem_mapping *next;
+} mem_mapping_t;
+
 /* private global variables */
 static unsigned char *heap;                 /* Starting address of heap */
 static unsigned char *mem_brk;              /* Current position of break */
+static unsigned char *mem_fresh;            /* Highest break since mem_init */
 static unsigned char *mem_max_addr;         /* Maximum allowable heap address */
+static mem_segment_t *mem_segment = NULL;   /* Segment the mm_ functions work on, NULL for the heap */
+static size_t mem_sbrks = 0;                /* mm_sbrk calls since the heap was last reset */
+static bool mem_file_backed = false;        /* Back the next heap with a memfd */
+static int mem_fd = -1;                     /* memfd backing the heap, or -1 */
+static bool mem_remapped = false;           /* Some heap page no longer maps its own file offset */
+static unsigned char *mem_map_lo = NULL;   /* Address space reserved for mm_mmap */
+static unsigned char *mem_map_max = NULL;
+static mem_mapping_t *mem_mappings = NULL;  /* Regions from mm_mmap, by address */
+static size_t mem_mapped = 0;               /* Bytes in mem_mappings */
+static bool mem_huge = false;               /* Ask for huge pages in the next mem_init */
+static bool mem_huge_active = false;        /* The heap and mappings are huge page aligned and advised */
+
+/* OS-backed mode (see mem_set_os_backed) */
+static size_t mem_commit_chunk = 0;         /* Heap commit granularity, 0 when off */
+static bool mem_populate = false;           /* Prefault committed memory */
+static size_t mem_committed = 0;            /* Heap bytes committed, from the start of the heap */
+static size_t mem_syscalls = 0;             /* Memory system calls since mem_os_reset_stats */
+static size_t mem_peak_committed = 0;       /* Peak heap plus mapping bytes committed since then */
+static struct rusage mem_rusage;            /* Resource usage at mem_os_reset_stats */
+
+/* mm_memcpy and mm_memset, picked for the CPU on first use */
+static void *(*mem_copy)(void *dst, const void *src, size_t n) = NULL;
+static void *(*mem_fill)(void *dst, int c, size_t n) = NULL;
+
+/* Copies and fills of at least this many bytes use non-temporal stores,
+ * which bypass the cache instead of evicting everything else from it */
+#define MEM_STREAM_BYTES (2 * 1024 * 1024)
+
+/*
+ * mem_advise_huge - asks for transparent huge pages behind [addr, addr+len)
+ *     if huge pages are on. Mappings made over a range lose the advice.
+ */
+static void mem_advise_huge(unsigned char *addr, size_t len) {
+    if (mem_huge_active) {
+	mem_syscalls++;
+	madvise(addr, len, MADV_HUGEPAGE);
+    }
+}
+
+/*
+ * mem_commit - makes [addr, addr+len) of a reservation usable, prefaulting
+ *     it if mem_populate is set. Returns 0, or -1 on failure.
+ */
+static int mem_commit(unsigned char *addr, size_t len) {
+    mem_syscalls++;
+    if (mem_populate && mem_huge_active) {
+	/* a new mapping would drop the huge page advice before faulting */
+	if (mprotect(addr, len, PROT_READ | PROT_WRITE) != 0)
+	    return -1;
+	mem_syscalls++;
+	return madvise(addr, len, MADV_POPULATE_WRITE);
+    }
+    if (mem_populate)
+	return (mmap(addr, len, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_POPULATE,
+		     -1, 0) == MAP_FAILED) ? -1 : 0;
+    return mprotect(addr, len, PROT_READ | PROT_WRITE);
+}
+
+/*
+ * mem_decommit - turns [addr, addr+len) back into inaccessible reserved
+ *     address space without physical pages
+ */
+static void mem_decommit(unsigned char *addr, size_t len) {
+    mem_syscalls++;
+    if (mmap(addr, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE,
+	     -1, 0) == MAP_FAILED) {
+	fprintf(stderr, "FAILURE.  mmap couldn't decommit %p (%zu bytes)\n", addr, len);
+	exit(1);
+    }
+    mem_advise_huge(addr, len);
+}
+
+/*
+ * mem_note_commit - records the bytes committed now in the peak
+ */
+static void mem_note_commit(void) {
+    if (mem_committed + mem_mapped > mem_peak_committed)
+	mem_peak_committed = mem_committed + mem_mapped;
+}
 
 /* 
  * mm_sbrk - simple model of the sbrk function. Extends the heap 
@@ -29,19 +144,44 @@ static unsigned char *mem_max_addr;         /* Maximum allowable heap address */
  *           new area. In this model, the heap cannot be shrunk.
  */
 void *mm_sbrk(intptr_t incr) {
-    unsigned char *old_brk = mem_brk;
+    unsigned char *lo = mem_segment ? mem_segment->lo : heap;
+    unsigned char **brk = mem_segment ? &mem_segment->brk : &mem_brk;
+    unsigned char **fresh = mem_segment ? &mem_segment->fresh : &mem_fresh;
+    unsigned char *max_addr = mem_segment ? mem_segment->max_addr : mem_max_addr;
+    unsigned char *old_brk = *brk;
 
+    mem_sbrks++;
     bool ok = true;
     if (incr < 0) {
 	ok = false;
 	fprintf(stderr, "ERROR: mm_sbrk failed.  Attempt to expand heap by negative value %ld\n", (long) incr);
-    } else if (mem_brk + incr > mem_max_addr) {
+    } else if (*brk + incr > max_addr) {
 	ok = false;
-	long alloc = mem_brk - heap + incr;
+	long alloc = *brk - lo + incr;
 	fprintf(stderr, "ERROR: mm_sbrk failed. Ran out of memory.  Would require heap size of %zd (0x%zx) bytes\n", alloc, alloc);
     }
+    if (ok && mem_commit_chunk != 0 && mem_segment == NULL &&
+	(size_t) (*brk + incr - lo) > mem_committed) {
+	/* commit whole chunks past the break, and whole huge pages */
+	size_t chunk = mem_commit_chunk;
+	if (mem_huge_active && chunk < HUGE_PAGE_SIZE)
+	    chunk = HUGE_PAGE_SIZE;
+	size_t want = (size_t) (*brk + incr - lo);
+	want = (want + chunk - 1) / chunk * chunk;
+	if (want > (size_t) (max_addr - lo))
+	    want = max_addr - lo;
+	if (mem_commit(lo + mem_committed, want - mem_committed) != 0) {
+	    ok = false;
+	    fprintf(stderr, "ERROR: mm_sbrk failed. Couldn't commit %zu bytes\n", want - mem_committed);
+	} else {
+	    mem_committed = want;
+	    mem_note_commit();
+	}
+    }
     if (ok) {
-	mem_brk += incr;
+	*brk += incr;
+	if (*brk > *fresh)
+	    *fresh = *brk;
 	return (void *) old_brk;
     } else {
 	errno = ENOMEM;
@@ -53,21 +193,31 @@ void *mm_sbrk(intptr_t incr) {
  * mm_heap_lo - return address of the first heap byte
  */
 void *mm_heap_lo(){
-    return (void *) heap;
+    return (void *) (mem_segment ? mem_segment->lo : heap);
 }
 
 /* 
  * mm_heap_hi - return address of last heap byte
  */
 void *mm_heap_hi(){
-    return (void *)(mem_brk - 1);
+    return (void *)((mem_segment ? mem_segment->brk : mem_brk) - 1);
+}
+
+/*
+ * mm_heap_fresh - return the address from which the heap has never
+ *     been handed out by mm_sbrk. Memory that mm_sbrk returns at or
+ *     above it reads as zero; memory below it may have been used by a
+ *     heap that was since reset.
+ */
+void *mm_heap_fresh(){
+    return (void *) (mem_segment ? mem_segment->fresh : mem_fresh);
 }
 
 /*
  * mm_heapsize - returns the heap size in bytes
  */
 size_t mm_heapsize() {
-    return (size_t)(mem_brk - heap);
+    return (size_t)((unsigned char *) mm_heap_hi() + 1 - (unsigned char *) mm_heap_lo());
 }
 
 /*
@@ -78,9 +228,551 @@ size_t mm_pagesize(){
 }
 
 /*
- * mm_memcpy - copies n bytes from src to dst
+ * mm_hugepagesize - returns the size of the huge pages backing the heap,
+ *     or 0 if the heap uses ordinary pages
  */
-void *mm_memcpy(void *dst, const void *src, size_t n) {
+size_t mm_hugepagesize(){
+    return mem_huge_active ? HUGE_PAGE_SIZE : 0;
+}
+
+/*
+ * mm_release - returns the physical pages backing the page-aligned
+ *              range [addr, addr+len) to the OS. The range stays
+ *              mapped and reads back as zero on its next access.
+ */
+int mm_release(void *addr, size_t len) {
+    int err;
+    mem_syscalls++;
+    if (mem_fd >= 0 && mem_segment == NULL)
+	err = fallocate(mem_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			(unsigned char *) addr - heap, len);
+    else if (mem_segment != NULL && mem_segment->shared)
+	err = madvise(addr, len, MADV_REMOVE);    /* DONTNEED would keep the shared pages */
+    else
+	err = madvise(addr, len, MADV_DONTNEED);
+    if (err != 0) {
+	fprintf(stderr, "ERROR: mm_release failed on %p (%zu bytes)\n", addr, len);
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * mm_remap - makes the heap page at dst share the physical page behind
+ *            the heap page at src. The old contents of dst are discarded
+ *            and its physical page is returned to the OS. Only possible
+ *            when the heap is file backed (see mem_set_file_backed);
+ *            returns -1 with errno set to ENOTSUP otherwise. Remapping
+ *            a page onto itself does nothing, so it tells whether
+ *            remapping is available.
+ */
+int mm_remap(void *dst, const void *src) {
+    size_t page = mem_pagesize();
+    if (mem_fd < 0 || mem_segment != NULL) {
+	errno = ENOTSUP;
+	return -1;
+    }
+    if (dst == src)
+	return 0;
+    off_t dst_off = (unsigned char *) dst - heap;
+    off_t src_off = (const unsigned char *) src - heap;
+    mem_syscalls += 2;
+    if (mmap(dst, page, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+	     mem_fd, src_off) == MAP_FAILED) {
+	fprintf(stderr, "ERROR: mm_remap failed to map %p onto %p\n", dst, src);
+	return -1;
+    }
+    mem_remapped = true;
+    return fallocate(mem_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, dst_off, page);
+}
+
+/*
+ * The mapping area: mm_mmap, mm_munmap and mm_mremap are emulated over
+ * address space reserved by mem_init, so that mappings stay apart from
+ * the rest of the process and the driver can tell where they are. A
+ * mapping is a page range of the area; unmapping hands its pages back
+ * to the OS with MADV_DONTNEED, so every page outside a mapping reads
+ * as zero and new mappings need no clearing. Mappings are kept sorted
+ * by address and placed first fit.
+ */
+
+/*
+ * mem_find_mapping - returns the link that points to the mapping at addr,
+ *     or NULL if addr does not start a mapping
+ */
+static mem_mapping_t **mem_find_mapping(const void *addr) {
+    mem_mapping_t **link;
+    for (link = &mem_mappings; *link != NULL; link = &(*link)->next) {
+	if ((*link)->addr == addr)
+	    return link;
+    }
+    return NULL;
+}
+
+/*
+ * mem_find_gap - returns the lowest address of the mapping area with len
+ *     unmapped bytes, or NULL if there is none. With huge pages, regions
+ *     of a huge page or more start on a huge page boundary.
+ */
+static unsigned char *mem_find_gap(size_t len) {
+    unsigned char *start = mem_map_lo;
+    uintptr_t mask = (mem_huge_active && len >= HUGE_PAGE_SIZE) ? HUGE_PAGE_SIZE - 1 : 0;
+    mem_mapping_t *map;
+    if (mem_map_lo == NULL)
+	return NULL;
+    for (map = mem_mappings; map != NULL; map = map->next) {
+	start = (unsigned char *) (((uintptr_t) start + mask) & ~mask);
+	if (map->addr >= start && (size_t) (map->addr - start) >= len)
+	    return start;
+	start = map->addr + map->len;
+    }
+    start = (unsigned char *) (((uintptr_t) start + mask) & ~mask);
+    return (mem_map_max >= start && (size_t) (mem_map_max - start) >= len) ? start : NULL;
+}
+
+/*
+ * mem_link_mapping - puts map into the mapping list at its address
+ */
+static void mem_link_mapping(mem_mapping_t *map) {
+    mem_mapping_t **link = &mem_mappings;
+    while (*link != NULL && (*link)->addr < map->addr)
+	link = &(*link)->next;
+    map->next = *link;
+    *link = map;
+}
+
+/*
+ * mem_discard - hands the pages of [addr, addr+len) back to the OS; they
+ *     read as zero afterwards
+ */
+static void mem_discard(unsigned char *addr, size_t len) {
+    if (len == 0)
+	return;
+    if (mem_commit_chunk != 0) {
+	mem_decommit(addr, len);
+	return;
+    }
+    mem_syscalls++;
+    if (madvise(addr, len, MADV_DONTNEED) != 0)
+	fprintf(stderr, "ERROR: madvise failed on %p (%zu bytes)\n", addr, len);
+}
+
+/*
+ * mm_mmap - maps len bytes (rounded up to whole pages) of zeroed memory
+ *     outside the heap. Returns NULL on failure, with errno ENOMEM if len
+ *     does not fit in whole pages. Without a mapping area
+ *     (memlib built for libmm.so), which also means without a list of
+ *     regions kept with malloc, every region is a real mapping of its
+ *     own.
+ */
+void *mm_mmap(size_t len) {
+    size_t page = mem_pagesize();
+    if (len > SIZE_MAX - (page - 1)) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    len = (len + page - 1) & ~(page - 1);
+    if (mem_map_lo == NULL) {
+	void *region = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (region == MAP_FAILED)
+	    return NULL;
+	mem_mapped += len;
+	return region;
+    }
+    unsigned char *addr = mem_find_gap(len);
+    if (addr == NULL) {
+	fprintf(stderr, "ERROR: mm_mmap failed. Ran out of mapping space for %zu bytes\n", len);
+	errno = ENOMEM;
+	return NULL;
+    }
+    mem_mapping_t *map = malloc(sizeof(mem_mapping_t));
+    if (map == NULL)
+	return NULL;
+    if (mem_commit_chunk != 0 && mem_commit(addr, len) != 0) {
+	free(map);
+	return NULL;
+    }
+    map->addr = addr;
+    map->len = len;
+    mem_link_mapping(map);
+    mem_mapped += len;
+    mem_note_commit();
+    return addr;
+}
+
+/*
+ * mm_munmap - unmaps a whole region returned by mm_mmap or mm_mremap
+ */
+int mm_munmap(void *addr, size_t len) {
+    if (mem_map_lo == NULL) {
+	size_t page = mem_pagesize();
+	len = (len + page - 1) & ~(page - 1);
+	if (munmap(addr, len) != 0)
+	    return -1;
+	mem_mapped -= len;
+	return 0;
+    }
+    mem_mapping_t **link = mem_find_mapping(addr);
+    if (link == NULL) {
+	fprintf(stderr, "ERROR: mm_munmap of %p, which is not a mapping\n", addr);
+	errno = EINVAL;
+	return -1;
+    }
+    mem_mapping_t *map = *link;
+    mem_discard(map->addr, map->len);
+    *link = map->next;
+    mem_mapped -= map->len;
+    free(map);
+    return 0;
+}
+
+/*
+ * mm_mremap - resizes a region returned by mm_mmap to new_len bytes
+ *     (rounded up to whole pages). A region grows in place if the pages
+ *     after it are unmapped; otherwise, if may_move is set, its page
+ *     mappings (not its data) are moved to a gap that is large enough.
+ *     Returns the region's address, or NULL if it could not be resized
+ *     (the region is then unchanged; errno is ENOMEM if new_len does not
+ *     fit in whole pages).
+ */
+void *mm_mremap(void *addr, size_t old_len, size_t new_len, bool may_move) {
+    size_t page = mem_pagesize();
+    if (new_len > SIZE_MAX - (page - 1)) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    if (mem_map_lo == NULL) {
+	old_len = (old_len + page - 1) & ~(page - 1);
+	new_len = (new_len + page - 1) & ~(page - 1);
+	void *region = mremap(addr, old_len, new_len, may_move ? MREMAP_MAYMOVE : 0);
+	if (region == MAP_FAILED)
+	    return NULL;
+	mem_mapped = mem_mapped - old_len + new_len;
+	return region;
+    }
+    mem_mapping_t **link = mem_find_mapping(addr);
+    if (link == NULL) {
+	fprintf(stderr, "ERROR: mm_mremap of %p, which is not a mapping\n", addr);
+	errno = EINVAL;
+	return NULL;
+    }
+    mem_mapping_t *map = *link;
+    new_len = (new_len + page - 1) & ~(page - 1);
+    unsigned char *limit = (map->next != NULL) ? map->next->addr : mem_map_max;
+
+    if (new_len <= map->len) {
+	mem_discard(map->addr + new_len, map->len - new_len);
+    } else if ((size_t) (limit - map->addr) < new_len) {
+	unsigned char *new_addr;
+	if (!may_move || (new_addr = mem_find_gap(new_len)) == NULL) {
+	    errno = ENOMEM;
+	    return NULL;
+	}
+	if (mem_commit_chunk != 0 &&
+	    mem_commit(new_addr + map->len, new_len - map->len) != 0)
+	    return NULL;
+	/* mremap leaves a hole behind, which is reserved again */
+	mem_syscalls += 2;
+	if (mremap(map->addr, map->len, map->len, MREMAP_MAYMOVE | MREMAP_FIXED,
+		   new_addr) == MAP_FAILED)
+	    return NULL;
+	if (mmap(map->addr, map->len, mem_commit_chunk != 0 ? PROT_NONE : PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+		 -1, 0) == MAP_FAILED) {
+	    fprintf(stderr, "FAILURE.  mmap couldn't restore mapping space\n");
+	    exit(1);
+	}
+	mem_advise_huge(map->addr, map->len);
+	*link = map->next;
+	map->addr = new_addr;
+	mem_link_mapping(map);
+    } else if (mem_commit_chunk != 0 &&
+	       mem_commit(map->addr + map->len, new_len - map->len) != 0) {
+	return NULL;
+    }
+    mem_mapped = mem_mapped - map->len + new_len;
+    map->len = new_len;
+    mem_note_commit();
+    return map->addr;
+}
+
+/*
+ * mm_segment_create - reserves an independent heap area of up to
+ *     max_size bytes with its own break. Returns NULL on failure.
+ */
+mem_segment_t *mm_segment_create(size_t max_size) {
+    mem_segment_t *seg = malloc(sizeof(mem_segment_t));
+    if (seg == NULL)
+	return NULL;
+    unsigned char *addr = mmap(NULL, max_size, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) {
+	free(seg);
+	return NULL;
+    }
+    seg->lo = addr;
+    seg->brk = addr;
+    seg->fresh = addr;
+    seg->max_addr = addr + max_size;
+    seg->shared = false;
+    return seg;
+}
+
+/*
+ * mem_init_lock - initializes the process-shared lock of a segment
+ */
+static void mem_init_lock(mem_segment_t *seg) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&seg->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/*
+ * mm_segment_create_shared - creates the POSIX shared memory object name
+ *     with max_size bytes and makes a segment of it, mapped at addr.
+ *     Other processes map it with mm_segment_attach at the same address,
+ *     so pointers into the segment mean the same thing everywhere. addr
+ *     must be page aligned and is required: an address the kernel picks
+ *     in one process is often taken in the next, so the caller chooses
+ *     one its processes keep free. The first page holds the segment
+ *     itself, including its break and a process-shared lock. Returns
+ *     NULL with errno set on failure: EINVAL without addr, EEXIST if the
+ *     name is taken or something is mapped at addr already.
+ */
+mem_segment_t *mm_segment_create_shared(const char *name, size_t max_size, void *addr) {
+    size_t page = mem_pagesize();
+    if (strlen(name) > MEM_SHM_NAME_MAX || max_size <= page || addr == NULL) {
+	errno = EINVAL;
+	return NULL;
+    }
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+	return NULL;
+    unsigned char *base = MAP_FAILED;
+    if (ftruncate(fd, max_size) == 0)
+	base = mmap(addr, max_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_NORESERVE | MAP_FIXED_NOREPLACE, fd, 0);
+    if (base != MAP_FAILED && base != addr) {     /* kernels before 4.17 take it as a hint */
+	munmap(base, max_size);
+	base = MAP_FAILED;
+	errno = EEXIST;
+    }
+    int err = errno;
+    close(fd);
+    if (base == MAP_FAILED) {
+	shm_unlink(name);
+	errno = err;
+	return NULL;
+    }
+
+    mem_segment_t *seg = (mem_segment_t *) base;
+    mem_init_lock(seg);
+    seg->magic = 0;
+    seg->layout = 0;
+    seg->user_root = NULL;
+    seg->lo = base + page;
+    seg->brk = seg->lo;
+    seg->fresh = seg->lo;
+    seg->max_addr = base + max_size;
+    seg->shared = true;
+    seg->creator = getpid();
+    strcpy(seg->name, name);
+    return seg;
+}
+
+/*
+ * mm_segment_open - maps the heap file path as a segment, creating it
+ *     with max_size bytes (sparse) at addr, or anywhere if addr is NULL,
+ *     if it doesn't exist yet. An existing file is mapped at the address
+ *     its header records, with its break and contents as they were, as
+ *     long as its magic number and layout match. Writes go to the file
+ *     (MAP_SHARED), so the heap outlives the process. *created tells
+ *     whether the file is new. Returns NULL with errno set on failure:
+ *     EINVAL for a file that isn't a heap of this layout, EEXIST if
+ *     something else is mapped where the heap has to go. Only one
+ *     process may have a heap file open at a time.
+ */
+mem_segment_t *mm_segment_open(const char *path, size_t max_size, void *addr,
+			       uint64_t layout, bool *created) {
+    size_t page = mem_pagesize();
+    mem_segment_t hdr;
+    struct stat st;
+    unsigned char *base = MAP_FAILED;
+    *created = false;
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+	return NULL;
+    if (fstat(fd, &st) != 0) {
+	/* errno is set */
+    } else if (st.st_size == 0) {
+	*created = true;
+	if (max_size <= page)
+	    errno = EINVAL;
+	else if (ftruncate(fd, max_size) == 0)
+	    base = mmap(addr, max_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_NORESERVE | (addr != NULL ? MAP_FIXED_NOREPLACE : 0),
+			fd, 0);
+    } else {
+	unsigned char *want = NULL;
+	if (pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t) sizeof(hdr) &&
+	    hdr.magic == MEM_FILE_MAGIC && hdr.layout == layout) {
+	    want = hdr.lo - page;
+	    if (hdr.max_addr - want != st.st_size || hdr.brk < hdr.lo ||
+		hdr.brk > hdr.max_addr || hdr.fresh < hdr.brk || hdr.fresh > hdr.max_addr)
+		want = NULL;
+	}
+	if (want == NULL)
+	    errno = EINVAL;
+	else
+	    base = mmap(want, st.st_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_NORESERVE | MAP_FIXED_NOREPLACE, fd, 0);
+	if (base != MAP_FAILED && base != want) {     /* kernels before 4.17 take it as a hint */
+	    munmap(base, st.st_size);
+	    base = MAP_FAILED;
+	    errno = EEXIST;
+	}
+    }
+    int err = errno;
+    close(fd);
+    if (base == MAP_FAILED) {
+	if (*created)
+	    unlink(path);
+	errno = err;
+	return NULL;
+    }
+
+    mem_segment_t *seg = (mem_segment_t *) base;
+    mem_init_lock(seg);     /* whoever held it is gone */
+    if (*created) {
+	seg->magic = MEM_FILE_MAGIC;
+	seg->layout = layout;
+	seg->lo = base + page;
+	seg->brk = seg->lo;
+	seg->fresh = seg->lo;
+	seg->max_addr = base + max_size;
+	seg->shared = true;
+	seg->creator = 0;   /* the file stays */
+	seg->name[0] = '\0';
+	seg->user_root = NULL;
+    }
+    return seg;
+}
+
+/*
+ * mm_segment_set_user_root - records ptr in the header of a shared or
+ *     file-backed segment, where a process mapping it later finds it
+ */
+void mm_segment_set_user_root(mem_segment_t *seg, void *ptr) {
+    seg->user_root = ptr;
+}
+
+/*
+ * mm_segment_user_root - returns the pointer last recorded with
+ *     mm_segment_set_user_root, NULL if none or not a shared segment
+ */
+void *mm_segment_user_root(mem_segment_t *seg) {
+    return (seg != NULL && seg->shared) ? seg->user_root : NULL;
+}
+
+/*
+ * mm_segment_sync - writes the used part of a file-backed segment out
+ *     to its file
+ */
+int mm_segment_sync(mem_segment_t *seg) {
+    return msync(seg, seg->brk - (unsigned char *) seg, MS_SYNC);
+}
+
+/*
+ * mm_segment_attach - maps the shared segment in the shared memory object
+ *     name at the address it was created at. Returns NULL with errno set
+ *     on failure, EEXIST if this process has something else there.
+ */
+mem_segment_t *mm_segment_attach(const char *name) {
+    size_t page = mem_pagesize();
+    struct stat st;
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+	return NULL;
+    unsigned char *base = MAP_FAILED;
+    mem_segment_t *hdr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size > page)
+	hdr = mmap(NULL, page, PROT_READ, MAP_SHARED, fd, 0);
+    if (hdr != MAP_FAILED) {
+	unsigned char *want = hdr->lo - page;
+	munmap(hdr, page);
+	base = mmap(want, st.st_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_NORESERVE | MAP_FIXED_NOREPLACE, fd, 0);
+	if (base != MAP_FAILED && base != want) {     /* kernels before 4.17 take it as a hint */
+	    munmap(base, st.st_size);
+	    base = MAP_FAILED;
+	    errno = EEXIST;
+	}
+    }
+    int err = errno;
+    close(fd);
+    errno = err;
+    return (base == MAP_FAILED) ? NULL : (mem_segment_t *) base;
+}
+
+/*
+ * mm_segment_lock - takes the lock of a shared segment; does nothing for
+ *     other segments. If a process died holding it, the lock is taken
+ *     over, though the heap may be left inconsistent.
+ */
+void mm_segment_lock(mem_segment_t *seg) {
+    if (seg != NULL && seg->shared &&
+	pthread_mutex_lock(&seg->lock) == EOWNERDEAD)
+	pthread_mutex_consistent(&seg->lock);
+}
+
+/*
+ * mm_segment_unlock - releases the lock of a shared segment
+ */
+void mm_segment_unlock(mem_segment_t *seg) {
+    if (seg != NULL && seg->shared)
+	pthread_mutex_unlock(&seg->lock);
+}
+
+/*
+ * mm_segment_destroy - unmaps a segment and everything in it. A shared
+ *     segment is only unmapped from this process; its memory object goes
+ *     away once the creating process destroys it and all others have
+ *     unmapped it. A heap file is synced and kept.
+ */
+void mm_segment_destroy(mem_segment_t *seg) {
+    if (mem_segment == seg)
+	mem_segment = NULL;
+    if (seg->shared) {
+	if (seg->magic == MEM_FILE_MAGIC)
+	    mm_segment_sync(seg);
+	if (seg->creator == getpid())
+	    shm_unlink(seg->name);
+	munmap(seg, seg->max_addr - (unsigned char *) seg);
+	return;
+    }
+    munmap(seg->lo, seg->max_addr - seg->lo);
+    free(seg);
+}
+
+/*
+ * mm_segment_select - makes mm_sbrk, mm_heap_lo/hi, mm_heapsize and
+ *     mm_release work on seg, or on the heap if seg is NULL. Returns
+ *     the segment selected before.
+ */
+mem_segment_t *mm_segment_select(mem_segment_t *seg) {
+    mem_segment_t *prev = mem_segment;
+    mem_segment = seg;
+    return prev;
+}
+
+/*
+ * memcpy_words - copies n bytes from src to dst, 8 bytes at a time
+ */
+static void *memcpy_words(void *dst, const void *src, size_t n) {
     void *savedst = dst;
     size_t w = sizeof(uint64_t);
     while (n >= w) {
@@ -98,9 +790,9 @@ void *mm_memcpy(void *dst, const void *src, size_t n) {
 }
 
 /*
- * mm_memset - sets the first n bytes of memory pointed to by dst to c
+ * memset_words - sets n bytes at dst to c, 8 bytes at a time
  */
-void *mm_memset(void *dst, int c, size_t n) {
+static void *memset_words(void *dst, int c, size_t n) {
     void *savedst = dst;
     uint64_t byte = c & 0xFF;
     uint64_t data = 0;
@@ -120,42 +812,412 @@ void *mm_memset(void *dst, int c, size_t n) {
     return savedst;
 }
 
+#ifdef __x86_64__
+/*
+ * The vector versions store the first and last vector of the range
+ * unaligned, and everything in between with aligned stores, so the
+ * head and tail overlap the body instead of needing byte loops.
+ * Ranges shorter than a vector go to the next smaller version.
+ */
+
+/*
+ * memcpy_sse2 - copies n bytes from src to dst, 16 bytes at a time
+ */
+static void *memcpy_sse2(void *dst, const void *src, size_t n) {
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+    if (n < 16)
+	return memcpy_words(dst, src, n);
+
+    __m128i head = _mm_loadu_si128((const __m128i *) s);
+    __m128i tail = _mm_loadu_si128((const __m128i *) (s + n - 16));
+    unsigned char *end = d + n - 16;
+    size_t skip = 16 - ((uintptr_t) d & 15);
+    bool stream = (n >= MEM_STREAM_BYTES);
+    d += skip;
+    s += skip;
+    for (; d < end; d += 16, s += 16) {
+	__m128i v = _mm_loadu_si128((const __m128i *) s);
+	if (stream)
+	    _mm_stream_si128((__m128i *) d, v);
+	else
+	    _mm_store_si128((__m128i *) d, v);
+    }
+    if (stream)
+	_mm_sfence();
+    _mm_storeu_si128((__m128i *) dst, head);
+    _mm_storeu_si128((__m128i *) end, tail);
+    return dst;
+}
+
+/*
+ * memset_sse2 - sets n bytes at dst to c, 16 bytes at a time
+ */
+static void *memset_sse2(void *dst, int c, size_t n) {
+    unsigned char *d = dst;
+    if (n < 16)
+	return memset_words(dst, c, n);
+
+    __m128i v = _mm_set1_epi8((char) c);
+    unsigned char *end = d + n - 16;
+    bool stream = (n >= MEM_STREAM_BYTES);
+    _mm_storeu_si128((__m128i *) d, v);
+    for (d += 16 - ((uintptr_t) d & 15); d < end; d += 16) {
+	if (stream)
+	    _mm_stream_si128((__m128i *) d, v);
+	else
+	    _mm_store_si128((__m128i *) d, v);
+    }
+    if (stream)
+	_mm_sfence();
+    _mm_storeu_si128((__m128i *) end, v);
+    return dst;
+}
+
+/*
+ * memcpy_avx2 - copies n bytes from src to dst, 32 bytes at a time
+ */
+__attribute__((target("avx2")))
+static void *memcpy_avx2(void *dst, const void *src, size_t n) {
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+    if (n < 32)
+	return memcpy_sse2(dst, src, n);
+
+    __m256i head = _mm256_loadu_si256((const __m256i *) s);
+    __m256i tail = _mm256_loadu_si256((const __m256i *) (s + n - 32));
+    unsigned char *end = d + n - 32;
+    size_t skip = 32 - ((uintptr_t) d & 31);
+    bool stream = (n >= MEM_STREAM_BYTES);
+    d += skip;
+    s += skip;
+    for (; d < end; d += 32, s += 32) {
+	__m256i v = _mm256_loadu_si256((const __m256i *) s);
+	if (stream)
+	    _mm256_stream_si256((__m256i *) d, v);
+	else
+	    _mm256_store_si256((__m256i *) d, v);
+    }
+    if (stream)
+	_mm_sfence();
+    _mm256_storeu_si256((__m256i *) dst, head);
+    _mm256_storeu_si256((__m256i *) end, tail);
+    return dst;
+}
+
+/*
+ * memset_avx2 - sets n bytes at dst to c, 32 bytes at a time
+ */
+__attribute__((target("avx2")))
+static void *memset_avx2(void *dst, int c, size_t n) {
+    unsigned char *d = dst;
+    if (n < 32)
+	return memset_sse2(dst, c, n);
+
+    __m256i v = _mm256_set1_epi8((char) c);
+    unsigned char *end = d + n - 32;
+    bool stream = (n >= MEM_STREAM_BYTES);
+    _mm256_storeu_si256((__m256i *) d, v);
+    for (d += 32 - ((uintptr_t) d & 31); d < end; d += 32) {
+	if (stream)
+	    _mm256_stream_si256((__m256i *) d, v);
+	else
+	    _mm256_store_si256((__m256i *) d, v);
+    }
+    if (stream)
+	_mm_sfence();
+    _mm256_storeu_si256((__m256i *) end, v);
+    return dst;
+}
+#endif /* __x86_64__ */
+
+/*
+ * mem_pick_simd - points mem_copy and mem_fill at the widest versions
+ *     the CPU supports
+ */
+static void mem_pick_simd(void) {
+    mem_copy = memcpy_words;
+    mem_fill = memset_words;
+#ifdef __x86_64__
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+	mem_copy = memcpy_avx2;
+	mem_fill = memset_avx2;
+    } else {
+	mem_copy = memcpy_sse2;     /* every x86-64 CPU has SSE2 */
+	mem_fill = memset_sse2;
+    }
+#endif
+}
+
+/*
+ * mm_memcpy - copies n bytes from src to dst
+ */
+void *mm_memcpy(void *dst, const void *src, size_t n) {
+    if (mem_copy == NULL)
+	mem_pick_simd();
+    return mem_copy(dst, src, n);
+}
+
+/*
+ * mm_memset - sets the first n bytes of memory pointed to by dst to c
+ */
+void *mm_memset(void *dst, int c, size_t n) {
+    if (mem_fill == NULL)
+	mem_pick_simd();
+    return mem_fill(dst, c, n);
+}
+
 /*************** Memory emulation  *******************/
 
+/*
+ * mem_reserve_huge - reserves len bytes of address space starting on a
+ *     huge page boundary and advises huge pages for it. Returns
+ *     MAP_FAILED on failure.
+ */
+static unsigned char *mem_reserve_huge(size_t len, int prot) {
+    unsigned char *addr = mmap(NULL, len + HUGE_PAGE_SIZE, prot,
+			       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED)
+	return addr;
+    unsigned char *start = (unsigned char *)
+	(((uintptr_t) addr + HUGE_PAGE_SIZE - 1) & ~(uintptr_t) (HUGE_PAGE_SIZE - 1));
+    if (start != addr)
+	munmap(addr, start - addr);
+    munmap(start + len, addr + HUGE_PAGE_SIZE - start);
+    madvise(start, len, MADV_HUGEPAGE);
+    return start;
+}
+
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(){
-    unsigned char* addr = mmap(NULL,                                        /* start*/
-                               MAX_HEAP_SIZE,                               /* length */
-                               PROT_READ | PROT_WRITE,                      /* permissions */
-                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, /* flags */
-                               -1,                                          /* fd */
-                               0);                                          /* offset */
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    int prot = (mem_commit_chunk != 0) ? PROT_NONE : PROT_READ | PROT_WRITE;
+    unsigned char *addr;
+    mem_huge_active = mem_huge && !mem_file_backed;
+    if (mem_file_backed) {
+	mem_fd = memfd_create("mm_heap", MFD_CLOEXEC);
+	if (mem_fd < 0 || ftruncate(mem_fd, MAX_HEAP_SIZE) != 0) {
+	    fprintf(stderr, "FAILURE.  couldn't create file backing for heap\n");
+	    exit(1);
+	}
+	flags = MAP_SHARED | MAP_NORESERVE;
+    }
+    if (mem_huge_active)
+	addr = mem_reserve_huge(MAX_HEAP_SIZE, prot);
+    else
+	addr = mmap(NULL,                                        /* start*/
+		    MAX_HEAP_SIZE,                               /* length */
+		    prot,                                        /* permissions */
+		    flags,                                       /* flags */
+		    mem_fd,                                      /* fd */
+		    0);                                          /* offset */
     if (addr == MAP_FAILED) {
 	fprintf(stderr, "FAILURE.  mmap couldn't allocate space for heap\n");
 	exit(1);
     }
     heap = addr;
+    mem_fresh = addr;
     mem_max_addr = addr + MAX_HEAP_SIZE;
+
+#ifndef DRIVER
+    /* libmm.so: regions are real mappings, see mm_mmap */
+    mem_committed = 0;
+    mem_reset_brk();
+    return;
+#endif
+    if (mem_huge_active)
+	addr = mem_reserve_huge(MAX_MAP_SIZE, prot);
+    else
+	addr = mmap(NULL, MAX_MAP_SIZE, prot,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) {
+	fprintf(stderr, "FAILURE.  mmap couldn't reserve mapping space\n");
+	exit(1);
+    }
+    mem_map_lo = addr;
+    mem_map_max = addr + MAX_MAP_SIZE;
+    mem_committed = 0;
     mem_reset_brk();
 }
 
+/*
+ * mem_unmap_all - unmaps every region still mapped by mm_mmap, whose
+ *     blocks went away with the heap
+ */
+static void mem_unmap_all(void) {
+    while (mem_mappings != NULL)
+	mm_munmap(mem_mappings->addr, mem_mappings->len);
+}
+
 /* 
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void){
+    mem_unmap_all();
+    if (mem_map_lo != NULL && munmap(mem_map_lo, MAX_MAP_SIZE) != 0) {
+        fprintf(stderr, "FAILURE.  munmap couldn't release mapping space\n");
+        exit(1);
+    }
+    mem_map_lo = mem_map_max = NULL;
     if (munmap(heap, MAX_HEAP_SIZE) != 0) {
         fprintf(stderr, "FAILURE.  munmap couldn't deallocate heap space\n");
         exit(1);
     }
+    if (mem_fd >= 0) {
+        close(mem_fd);
+        mem_fd = -1;
+    }
+    mem_remapped = false;
+}
+
+/*
+ * mem_set_file_backed - back heaps created by later calls to mem_init
+ *     with a memfd, so that mm_remap can alias heap pages
+ */
+void mem_set_file_backed(bool file_backed) {
+    mem_file_backed = file_backed;
+}
+
+/*
+ * mem_set_huge_pages - makes later calls to mem_init align the heap and
+ *     the mapping area to huge pages and advise transparent huge pages
+ *     (MADV_HUGEPAGE) for them. File-backed heaps keep ordinary pages.
+ */
+void mem_set_huge_pages(bool huge) {
+    mem_huge = huge;
+}
+
+/*
+ * mem_set_os_backed - makes later calls to mem_init reserve the heap and
+ *     the mapping area without access, and commit memory with real
+ *     mprotect calls: the heap in chunks of commit_chunk bytes (rounded
+ *     to whole pages) as mm_sbrk reaches them, mappings as mm_mmap makes
+ *     them. Unmapped memory and, on mem_reset_brk, the whole heap are
+ *     decommitted again, so every run pays for its own memory. With
+ *     populate, memory is committed with MAP_POPULATE instead, which
+ *     faults it in up front. A commit_chunk of 0 turns the mode off.
+ *     Not for file-backed heaps or segments.
+ */
+void mem_set_os_backed(size_t commit_chunk, bool populate) {
+    size_t page = mem_pagesize();
+    mem_commit_chunk = (commit_chunk + page - 1) & ~(page - 1);
+    mem_populate = populate;
+}
+
+/*
+ * mem_os_reset_stats - starts counting mem_os_stats from zero
+ */
+void mem_os_reset_stats(void) {
+    mem_syscalls = 0;
+    mem_peak_committed = mem_committed + mem_mapped;
+    getrusage(RUSAGE_SELF, &mem_rusage);
+}
+
+/*
+ * mem_os_stats - kernel work since the last mem_os_reset_stats. Faults
+ *     and CPU times cover the whole process, the driver included.
+ */
+void mem_os_stats(mem_os_stats_t *stats) {
+    struct rusage now;
+    getrusage(RUSAGE_SELF, &now);
+    stats->syscalls = mem_syscalls;
+    stats->peak_committed = mem_peak_committed;
+    stats->minor_faults = now.ru_minflt - mem_rusage.ru_minflt;
+    stats->user_secs = (now.ru_utime.tv_sec - mem_rusage.ru_utime.tv_sec) +
+	(now.ru_utime.tv_usec - mem_rusage.ru_utime.tv_usec) / 1e6;
+    stats->sys_secs = (now.ru_stime.tv_sec - mem_rusage.ru_stime.tv_sec) +
+	(now.ru_stime.tv_usec - mem_rusage.ru_stime.tv_usec) / 1e6;
+}
+
+/*
+ * mem_resident - number of the npages pages from lo that are in memory
+ */
+static size_t mem_resident(unsigned char *lo, size_t npages) {
+    size_t page = mem_pagesize();
+    size_t resident = 0;
+    unsigned char vec[4096];
+    size_t i, j;
+    for (i = 0; i < npages; i += sizeof(vec)) {
+	size_t n = (npages - i < sizeof(vec)) ? npages - i : sizeof(vec);
+	if (mincore(lo + i * page, n * page, vec) != 0)
+	    return 0;
+	for (j = 0; j < n; j++)
+	    resident += vec[j] & 1;
+    }
+    return resident;
+}
+
+/*
+ * mem_phys_pages - number of physical pages currently backing the heap
+ *     and the mm_mmap regions
+ */
+size_t mem_phys_pages(void) {
+    size_t page = mem_pagesize();
+    size_t resident = 0;
+    mem_mapping_t *map;
+    for (map = mem_mappings; map != NULL; map = map->next)
+	resident += mem_resident(map->addr, map->len / page);
+    if (mem_fd >= 0) {
+	struct stat st;
+	if (fstat(mem_fd, &st) != 0)
+	    return 0;
+	return resident + (size_t) st.st_blocks * 512 / page;
+    }
+    return resident + mem_resident(heap, (mem_heapsize() + page - 1) / page);
+}
+
+/*
+ * mem_mapped_bytes - bytes currently mapped by mm_mmap
+ */
+size_t mem_mapped_bytes(void) {
+    return mem_mapped;
+}
+
+/*
+ * mem_in_mapping - tells whether [lo, hi] lies inside one mm_mmap region
+ */
+bool mem_in_mapping(const void *lo, const void *hi) {
+    mem_mapping_t *map;
+    for (map = mem_mappings; map != NULL; map = map->next) {
+	if ((const unsigned char *) lo >= map->addr &&
+	    (const unsigned char *) hi < map->addr + map->len)
+	    return true;
+    }
+    return false;
+}
+
+/*
+ * mem_sbrk_calls - number of mm_sbrk calls since the last mem_reset_brk
+ */
+size_t mem_sbrk_calls(void) {
+    return mem_sbrks;
 }
 
 /*
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
  */
 void mem_reset_brk(){
+    if (mem_remapped) {
+	/* give every page its own file offset again */
+	if (mmap(heap, mem_brk - heap, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_FIXED, mem_fd, 0) == MAP_FAILED) {
+	    fprintf(stderr, "FAILURE.  mmap couldn't restore heap mapping\n");
+	    exit(1);
+	}
+	mem_remapped = false;
+    }
     mem_brk = heap;
+    mem_sbrks = 0;
+    mem_unmap_all();
+    if (mem_commit_chunk != 0 && mem_committed != 0) {
+	/* the next run commits its heap again, and finds it zeroed */
+	mem_decommit(heap, mem_committed);
+	mem_committed = 0;
+	mem_fresh = heap;
+    }
 }
 
 void *mem_sbrk(intptr_t incr) {
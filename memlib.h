@@ -7,11 +7,37 @@
 void *mm_sbrk(intptr_t incr);
 void *mm_heap_lo(void);
 void *mm_heap_hi(void);
+void *mm_heap_fresh(void);
 size_t mm_heapsize(void);
 size_t mm_pagesize(void);
+size_t mm_hugepagesize(void);
+int mm_release(void *addr, size_t len);
+int mm_remap(void *dst, const void *src);
+void *mm_mmap(size_t len);
+int mm_munmap(void *addr, size_t len);
+void *mm_mremap(void *addr, size_t old_len, size_t new_len, bool may_move);
 void *mm_memcpy(void *dst, const void *src, size_t n);
 void *mm_memset(void *dst, int c, size_t n);
 
+/* Independent heap areas, for allocators with more than one heap */
+typedef struct mem_segment mem_segment_t;
+mem_segment_t *mm_segment_create(size_t max_size);
+void mm_segment_destroy(mem_segment_t *seg);
+mem_segment_t *mm_segment_select(mem_segment_t *seg);
+
+/* Segments in POSIX shared memory, mapped at the same address by several processes */
+mem_segment_t *mm_segment_create_shared(const char *name, size_t max_size, void *addr);
+mem_segment_t *mm_segment_attach(const char *name);
+void mm_segment_lock(mem_segment_t *seg);
+void mm_segment_unlock(mem_segment_t *seg);
+
+/* Segments in a heap file that a later process can map again */
+mem_segment_t *mm_segment_open(const char *path, size_t max_size, void *addr,
+			       uint64_t layout, bool *created);
+int mm_segment_sync(mem_segment_t *seg);
+void mm_segment_set_user_root(mem_segment_t *seg, void *ptr);
+void *mm_segment_user_root(mem_segment_t *seg);
+
 /* Functions used for memory emulation */
 /* You should not be calling these functions */
 
@@ -19,11 +45,29 @@ void mem_init();
 void mem_deinit(void);
 void *mem_sbrk(intptr_t incr);
 void mem_reset_brk(void); 
+void mem_set_file_backed(bool file_backed);
+void mem_set_os_backed(size_t commit_chunk, bool populate);
+void mem_set_huge_pages(bool huge);
+size_t mem_phys_pages(void);
+size_t mem_mapped_bytes(void);
+bool mem_in_mapping(const void *lo, const void *hi);
+size_t mem_sbrk_calls(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
 
+/* Kernel work done for the memory system, see mem_set_os_backed */
+typedef struct {
+    size_t syscalls;        /* mmap, mprotect, mremap, madvise and fallocate calls */
+    size_t peak_committed;  /* peak bytes committed to the heap and mappings */
+    long minor_faults;      /* minor page faults of the process */
+    double user_secs;       /* CPU time of the process in user mode */
+    double sys_secs;        /* CPU time of the process in the kernel */
+} mem_os_stats_t;
+void mem_os_reset_stats(void);
+void mem_os_stats(mem_os_stats_t *stats);
+
 /* Read len bytes and return value zero-extended to 64 bits */
 /* Require 0 <= len <= 8 */
 uint64_t mem_read(const void *addr, size_t len);
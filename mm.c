@@ -56,6 +56,21 @@
  * If we have many small free blocks, say 16 in size, but only one that is 4096 in size. It we wabnt to allocate 4096, we have
  * to iterate through all 16 sized blocks, which takes time. To avoid this, the can search directly in a list 
  * specifically made for block of size greater than 4096.
+ * The size classes come from size_classes.h: a table indexed by size/16 for small blocks, then a fixed number of classes
+ * per power of two computed from the leading zero count, so picking a list takes no chain of comparisons. A free block
+ * keeps its list index in the top byte of its header, which lets it be unlinked without recomputing the class.
+ * The table classes are a starting point: busy classes with long free lists are split and quiet ones merged while running.
+ * mm_malloc_hint adds one set of these lists per hint group (short-lived, long-lived, hot), so blocks with different
+ * expected lifetimes mostly reuse each other's free space only when their own group has none.
+ * 
+ * Page spans:
+ * Blocks of 32 KiB and more do not use headers and footers at all. They are runs of whole pages (spans) whose
+ * metadata lives in a separate small block, found through a radix tree keyed by page number, like tcmalloc's
+ * page heap. Freeing or resizing a large block only touches its metadata, adjacent free spans are coalesced
+ * through the same tree, and large free spans hand their pages back to the OS. The span pages sit inside an
+ * allocated "fence" block, so the boundary-tagged heap around them does not need to know about them.
+ * When memlib backs the heap with huge pages, the heap grows to huge page boundaries (so large spans start on
+ * one) and free spans only hand back the huge pages they cover entirely, which keeps the rest from being split.
  * 
  * Key aspects:
  * Malloc and realloc use free. This is a big part of the design because it allowed for me to reuse a lot of code and make the debugging less tedious.
@@ -71,16 +86,27 @@
  *
  */
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <stdbool.h>
+#ifndef DRIVER
+#include <pthread.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
 
+// size-class table, "make CLASSES=<header>" selects one made by size_classes.pl
+#ifdef SIZE_CLASSES
+#include SIZE_CLASSES
+#else
+#include "size_classes.h"
+#endif
+
 /*
  * If you want to enable your debugging output and heap checker code,
  * uncomment the following line. Be sure not to have debugging enabled
@@ -99,12 +125,19 @@
 #endif // DEBUG
 
 // do not change the following!
-#ifdef DRIVER
-// create aliases for driver tests
+// create aliases for driver tests. Without DRIVER (libmm.so), the standard names are the entry points at
+// the end of this file, which wrap these.
 #define malloc mm_malloc
 #define free mm_free
 #define realloc mm_realloc
 #define calloc mm_calloc
+#define memalign mm_memalign
+#define posix_memalign mm_posix_memalign
+#define aligned_alloc mm_aligned_alloc
+#define malloc_usable_size mm_usable_size
+#define free_sized mm_free_sized
+#define free_aligned_sized mm_free_aligned_sized
+#ifdef DRIVER
 #define memset mm_memset
 #define memcpy mm_memcpy
 #endif // DRIVER
@@ -117,7 +150,12 @@ static size_t align(size_t x)
     return ALIGNMENT * ((x+ALIGNMENT-1)/ALIGNMENT);
 }
 
+static bool in_heap(const void* p);
 static bool aligned(const void* p);
+static size_t* epilogue(void);
+static void free_block(void* ptr);
+static bool check_heap(void);
+void* insert(size_t* curr, size_t size);
 
 // struct for Doubly Linked List Node
 typedef struct dll_node{
@@ -125,9 +163,169 @@ typedef struct dll_node{
     struct dll_node* next;
 } dll_node_t;
 
-dll_node_t* seg_list[15];
+/*
+ * Requests of SPAN_MIN_PAGES pages or more are served from page spans instead of
+ * boundary-tagged blocks (see "Page spans" below).
+ */
+#define PAGE_SHIFT 12
+#define PAGE_BYTES (1UL << PAGE_SHIFT)
+#define SPAN_MIN_PAGES 8    // 32 KiB
+#define SPAN_MIN_BYTES (SPAN_MIN_PAGES * PAGE_BYTES)
+#define SPAN_LISTS 8    // free spans are bucketed by log2 of their page count
+#define SPAN_RELEASE_PAGES 256  // free spans of 1 MiB or more give their pages back to the OS
+#define PAGEMAP_BITS 9  // 4 levels of 9 bits cover the 36-bit page numbers of a 48-bit address space
+#define PAGEMAP_LEVELS 4
+#define MAP_MIN_BYTES (1024 * 1024)    // blocks this large may get a mapping of their own (see "Mapped blocks" below)
+#define MAP_MAX_BYTES (32 * 1024 * 1024)   // blocks this large always do
+#define MAX_REQUEST_BYTES (1UL << 47)   // half the address space; larger requests fail before rounding them up wraps
+
+// low header bits besides the allocated bit; either one also makes the block look allocated
+#define FENCE 0x2   // allocated block wrapping span pages
+#define PINNED 0x4  // free block taken out of the free lists for good by meshing
+
+// the top byte of a free block's header caches the index of its segregated list, and bits 48-49 of every
+// block's header hold its hint group (see "Allocation hints" below); sizes use the bits below
+#define CLASS_SHIFT 56
+#define LIST_BITS 0xff
+#define HINT_SHIFT 48
+#define HINT_MASK (3UL << HINT_SHIFT)
+#define SIZE_MASK ((1UL << HINT_SHIFT) - ALIGNMENT)
+#define HINT_GROUPS 4   // unhinted, short-lived, long-lived or cold, hot
+#define NUM_CLASSES (SMALL_CLASSES + (LARGE_CLASS_TOP_SHIFT - SMALL_CLASS_SHIFT) * LARGE_CLASSES_PER_POW2)
+#define SMALL_BINS (SMALL_CLASS_MAX / 16 + 1)   // one per payload size up to SMALL_CLASS_MAX
+
+_Static_assert(NUM_CLASSES <= LIST_BITS + 1, "the list index cached in free block headers is too narrow");
+#ifdef MM_STATS
+_Static_assert(NUM_CLASSES <= MM_STATS_CLASSES, "mm_stats_t has too few per-class counters");
+#endif
+
+// the table classes adapt to the request sizes seen (see "Adaptive size classes" below)
+#define ADAPT_PERIOD 4096   // mallocs between adaptation steps
+#define ADAPT_SPLIT_LEN 32  // a class with more free blocks than this may be split
+#define ADAPT_RATIO 8       // classes merged to make room must see this much less traffic
+
+#define PROBE_HIST 512  // probe counts tracked exactly, larger ones share the last bucket
+
+// the heap grows by at least a chunk, which doubles while misses keep coming and halves when they stop
+#define GROW_MIN 256
+#define GROW_MAX (16 * 1024)
+#define GROW_SHARE 16    // a chunk is at most this fraction of the bytes outside the free lists
+#define GROW_RECENT 64  // a miss within this many mallocs of the last one means the heap is still growing
+
+#define HEAP_FILE_VERSION 2   // bump when the heap layout changes in a way sizeof(heap_root_t) does not show
+
+#define REGION_CHUNK (16 * 1024)    // bytes regions bump-allocate from, larger requests get a chunk of their own
+#define SLAB_BYTES (16 * 1024)      // object cache slab size, grown to hold at least SLAB_MIN_OBJECTS
+#define SLAB_MIN_OBJECTS 8
+
+// struct for a run of pages holding one large block (or free pages)
+typedef struct span{
+    uintptr_t start;    // first page number
+    size_t npages;
+    struct span* prev;  // links in the free span lists
+    struct span* next;
+    bool free;
+    bool released;  // pages are not backed by physical memory right now
+    bool zeroed;    // pages are known to read as zero
+} span_t;
+
+// header in front of a block that has a memlib mapping of its own
+typedef struct map_block{
+    size_t len;     // bytes mapped, this header included
+    struct map_block* prev;     // links in the heap's list of mapped blocks
+    struct map_block* next;
+} __attribute__((aligned(ALIGNMENT))) map_block_t;
+
+// one set of segregated free lists; each hint group has its own
+typedef struct free_lists{
+    dll_node_t* seg_list[NUM_CLASSES];  // heads of the segregated free lists
+    uint32_t list_len[NUM_CLASSES];     // free blocks in each list
+} free_lists_t;
+
+#ifdef MM_STATS
+// counters behind mm_stats; everything else it reports is read off the heap when asked
+typedef struct heap_stats{
+    size_t sbrk_calls;
+    size_t sbrk_bytes;
+    size_t splits[MM_SPLIT_CASES];
+    size_t coalesces[MM_COALESCE_CASES];
+    size_t reallocs[MM_REALLOC_CASES];
+    size_t realloc_copied;
+} heap_stats_t;
+#endif
+
+// root metadata, stored at the very start of the heap in front of the prologue
+typedef struct heap_root{
+    free_lists_t lists;     // free lists of unhinted blocks
+    free_lists_t* groups[HINT_GROUPS];  // free lists of each hint group, made on first use; groups[0] is &lists
+    int alloc_group;        // hint group of the block malloc is looking for
+    unsigned char order[NUM_CLASSES];   // class -> seg_list index, classes in increasing size order
+    unsigned char class_map[SMALL_BINS];    // size / 16 -> class, starts out as class_index
+    uint32_t size_hist[SMALL_BINS];     // recent requests per size / 16, halved at every adaptation step
+    size_t mallocs;
+    uint32_t probe_hist[PROBE_HIST];    // mallocs by number of free blocks inspected
+    size_t probe_max;
+    size_t grow_chunk;  // least number of bytes the heap grows by
+    size_t free_bytes;  // bytes in the free lists of all hint groups
+    size_t last_grow;   // value of mallocs at the last extension
+    span_t* free_spans[SPAN_LISTS];
+    void** pagemap;     // radix tree root: page number -> span owning that page
+    size_t* fence;      // header of the most recently created span fence
+    map_block_t* mapped;        // blocks outside the heap in mappings of their own
+    size_t map_min;             // mallocs of this many bytes or more get a mapping
+    mem_segment_t* segment;     // memlib segment holding the heap, NULL for memlib's own heap
+#ifdef MM_STATS
+    heap_stats_t stats;
+#endif
+} __attribute__((aligned(ALIGNMENT))) heap_root_t;    // keeps the prologue and blocks after it aligned
+
+void* first;    // pointer to the initial heap extension (the heap root) of the heap in use
+static size_t probe_limit;  // free blocks one malloc inspects in all, 0 for no limit
+
+// returns the root metadata at the start of the heap
+static heap_root_t* heap_root(void){
+    return (heap_root_t*)first;
+}
+
+/*
+ * Statistics
+ * With MM_STATS, the heap root carries counters for mm_stats; without it, the functions below are empty
+ * and the calls to them compile away.
+ */
+
+// mm_sbrk on the heap in use, counting the bytes it grows by
+static void* heap_sbrk(intptr_t incr){
+    void* old_brk = mm_sbrk(incr);
+#ifdef MM_STATS
+    if (old_brk != (void*)-1){
+        heap_root()->stats.sbrk_calls++;
+        heap_root()->stats.sbrk_bytes += incr;
+    }
+#endif
+    return old_brk;
+}
+
+// counts a free block split off an allocated one, by MM_SPLIT_* case
+static void count_split(int kind){
+#ifdef MM_STATS
+    heap_root()->stats.splits[kind]++;
+#endif
+}
+
+// counts a free by the MM_COALESCE_* case of its neighbours
+static void count_coalesce(int kind){
+#ifdef MM_STATS
+    heap_root()->stats.coalesces[kind]++;
+#endif
+}
 
-void* first;    // pointer to the initial heap extension
+// counts a realloc by MM_REALLOC_* case, with the payload bytes it copied
+static void count_realloc(int kind, size_t copied){
+#ifdef MM_STATS
+    heap_root()->stats.reallocs[kind]++;
+    heap_root()->stats.realloc_copied += copied;
+#endif
+}
 
 /*
  * mm_init: returns false on error, true on success.
@@ -140,94 +338,79 @@ bool mm_init(void)
     size_t* pro_foot;
     size_t* epi; 
 
-    // make initial space and assign initial pointer
-    if ((first = mm_sbrk(32)) == (void*)-1){
+    // make initial space for the root and the prologue/epilogue and assign initial pointer
+    if ((first = mm_sbrk(sizeof(heap_root_t) + 32)) == (void*)-1){
         return false;
     }
 
-    pro_head = first + 8;   // initialize pointer for prologue
-    pro_foot = first + 16;
-    epi = first + 24;    //init pointer for epilogue
+    heap_root_t* root = first;    // empty free lists, no spans and an empty pagemap
+    for (int list_num = 0; list_num < NUM_CLASSES; list_num++){
+        root->lists.seg_list[list_num] = NULL;
+        root->lists.list_len[list_num] = 0;
+        root->order[list_num] = list_num;
+    }
+    root->groups[0] = &root->lists;
+    for (int group = 1; group < HINT_GROUPS; group++){
+        root->groups[group] = NULL;
+    }
+    root->alloc_group = 0;
+    for (int bin = 0; bin < SMALL_BINS; bin++){
+        root->class_map[bin] = class_index[bin];
+        root->size_hist[bin] = 0;
+    }
+    root->mallocs = 0;
+    for (int probes = 0; probes < PROBE_HIST; probes++){
+        root->probe_hist[probes] = 0;
+    }
+    root->probe_max = 0;
+    root->grow_chunk = GROW_MIN;
+    root->free_bytes = 0;
+    root->last_grow = 0;
+    for (int list_num = 0; list_num < SPAN_LISTS; list_num++){
+        root->free_spans[list_num] = NULL;
+    }
+    root->pagemap = NULL;
+    root->fence = NULL;
+    root->mapped = NULL;
+    root->map_min = MAP_MIN_BYTES;
+    root->segment = NULL;
+#ifdef MM_STATS
+    memset(&root->stats, 0, sizeof(heap_stats_t));
+    root->stats.sbrk_calls = 1;     // the root's own
+    root->stats.sbrk_bytes = sizeof(heap_root_t) + 32;
+#endif
+
+    pro_head = first + sizeof(heap_root_t) + 8;   // initialize pointer for prologue
+    pro_foot = first + sizeof(heap_root_t) + 16;
+    epi = first + sizeof(heap_root_t) + 24;    //init pointer for epilogue
 
     *pro_head = 0x11;    // initialize values for proloque
     *pro_foot = 0x11;
     *epi = 0x1;    //initialize values for epilogue
 
-    // initialize and set heads of segregated free lists
-    struct dll_node* dll_head16 = NULL; // 0
-    struct dll_node* dll_head32 = NULL; // 1
-    struct dll_node* dll_head48 = NULL; // 2
-    struct dll_node* dll_head64 = NULL; // 3
-    struct dll_node* dll_head80 = NULL; // 4
-    struct dll_node* dll_head96 = NULL; // 5
-    struct dll_node* dll_head112 = NULL; // 6
-    struct dll_node* dll_head128 = NULL; // 7
-    struct dll_node* dll_head144 = NULL; // 8
-    struct dll_node* dll_head160 = NULL; // 9
-    struct dll_node* dll_head256 = NULL; // 10
-    struct dll_node* dll_head512  = NULL; // 11
-    struct dll_node* dll_head1024 = NULL; // 12
-    struct dll_node* dll_head2048 = NULL; // 13
-    struct dll_node* dll_head4096 = NULL; // 14
-
-    seg_list[0] = dll_head16; // 0
-    seg_list[1] = dll_head32; // 1
-    seg_list[2] = dll_head48; // 2
-    seg_list[3] = dll_head64; // 3
-    seg_list[4] = dll_head80; // 4
-    seg_list[5] = dll_head96; // 5
-    seg_list[6] = dll_head112; // 6
-    seg_list[7] = dll_head128; // 7
-    seg_list[8] = dll_head144; // 8
-    seg_list[9] = dll_head160; // 9
-    seg_list[10] = dll_head256; // 10
-    seg_list[11]= dll_head512; // 11
-    seg_list[12] = dll_head1024; // 12
-    seg_list[13] = dll_head2048; // 13
-    seg_list[14] = dll_head4096; // 14
-
     return true;
 }
 
-// takes in the size and outputs the index of the corresponding seg list
-int find_list(size_t size){
-    if (size == 16){ 
-        return 0;
-    } else if (size == 32){
-        return 1;
-    } else if (size == 48){
-        return 2;
-    } else if (size == 64){
-        return 3;
-    } else if (size == 80){
-        return 4;
-    } else if (size == 96){
-        return 5;
-    } else if (size == 112){
-        return 6;
-    } else if (size == 128){
-        return 7;
-    } else if (size == 144){
-        return 8;
-    } else if (size == 160){
-        return 9;
-    } else if (size <= 256){
-        return 10;
-    } else if (size <= 512){
-        return 11;
-    } else if (size <= 1024){
-        return 12;
-    }else if (size <= 4096){
-        return 13;
-    } else{
-        return 14;
+// takes in the size and outputs its size class. Small sizes go through the class map,
+// larger ones get LARGE_CLASSES_PER_POW2 classes per power of two.
+int find_class(size_t size){
+    if (size <= SMALL_CLASS_MAX){
+        return heap_root()->class_map[size >> 4];
     }
+    int log = 63 - __builtin_clzl(size - 1);    // 2^log < size <= 2^(log+1)
+    int class_num = SMALL_CLASSES + (log - SMALL_CLASS_SHIFT) * LARGE_CLASSES_PER_POW2
+                    + (((size - 1) >> (log - 2)) & (LARGE_CLASSES_PER_POW2 - 1));
+    return class_num < NUM_CLASSES ? class_num : NUM_CLASSES - 1;
+}
 
+// takes in the size and outputs the index of the corresponding seg list
+int find_list(size_t size){
+    return heap_root()->order[find_class(size)];
 }
 
 // takes a head and outputs block size, ie. payload size + header + footer.
 size_t get_size(size_t* curr){
-    return (*curr & 0xfffffffffffffff0);
+    return (*curr & SIZE_MASK);
 }
 
 // takes total block size and sets allocated to 1
@@ -235,11 +418,13 @@ size_t set_alloc(size_t size){
     return 0x1 | size;
 }
 
-// deletes a DLL node when size is exactly block size - returns nothing
-void delete_node(size_t* curr, size_t size){
+// deletes a DLL node, using the list index cached in its header - returns nothing
+void delete_node(size_t* curr){
     dll_node_t* body = (dll_node_t*)curr;
+    free_lists_t* lists = heap_root()->groups[(*(curr - 1) & HINT_MASK) >> HINT_SHIFT];
+    dll_node_t** seg_list = lists->seg_list;
 
-    int list_num = find_list(size);
+    int list_num = (*(curr - 1) >> CLASS_SHIFT) & LIST_BITS;
 
     if (seg_list[list_num] == body && body->next == body){  // case where node is head and it is the only node in list
         seg_list[list_num] = NULL;  // list is now empy
@@ -248,73 +433,126 @@ void delete_node(size_t* curr, size_t size){
     else if(seg_list[list_num] == body && body->next != body){  // case where node is head but it is not the only node
         seg_list[list_num] = body->prev;    // make next node head
     }
+    lists->list_len[list_num]--;
+    heap_root()->free_bytes -= get_size(curr - 1);
 
     body->prev->next = body->next;
     body->next->prev = body->prev;
 }
 
-// extends the heap by size amount - returns a pointer to payload
-void* extend_heap(size_t size){
-    size_t* new;
-    if ((new = mm_sbrk(align(size + 16))) != (void*)-1){    // creates new space with for size + header + footer
-
-        size_t* epi = new + (size/(sizeof(size_t)) + 1);
-        *epi = 0x1;
-
-        size_t* new1 = new - (1);
-        *new1 = set_alloc(size+16);
+// extends the heap for an allocated block of size bytes (aligned) - returns a pointer to payload.
+// A free block at the top of the heap is used or grown, and small requests grow the heap by a whole chunk
+// whose surplus is freed, so a run of misses moves the break only once per chunk. cut_short tells that the
+// caller stopped searching the free lists at the probe limit: a free block might have served it, so the heap
+// grows by the block alone and the chunk is left as it is.
+void* extend_heap(size_t size, bool cut_short){
+    heap_root_t* root = heap_root();
+    size_t b_size = size + 16;
+
+    if (!cut_short){    // still growing: double the chunk, otherwise let it shrink back
+        if (root->mallocs - root->last_grow <= GROW_RECENT){
+            root->grow_chunk = (root->grow_chunk < GROW_MAX) ? root->grow_chunk * 2 : GROW_MAX;
+        }
+        else{
+            root->grow_chunk = (root->grow_chunk > GROW_MIN) ? root->grow_chunk / 2 : GROW_MIN;
+        }
+        root->last_grow = root->mallocs;
+    }
 
-        size_t* new_last = new + (size/sizeof(size_t));
-        *new_last = set_alloc(size+16); 
+    size_t* epi = epilogue();
+    size_t top = ((*(epi - 1) & 0xf) == 0) ? *(epi - 1) : 0;  // size of a free block ending the heap
+    if (top >= b_size){     // batches, which look only for runs of free blocks, may still find room there
+        return insert(epi - top/8, size);
+    }
+    size_t grow = b_size - top;
+    size_t chunk = cut_short ? 0 : root->grow_chunk;
+    size_t live = mm_heapsize() - root->free_bytes;     // bytes outside the free lists
+    if (chunk > live/GROW_SHARE){   // the surplus never exceeds a fixed share of them
+        chunk = live/GROW_SHARE & ~(size_t)(ALIGNMENT - 1);
+    }
+    if (b_size < chunk && grow < chunk){
+        grow = chunk;
+    }
+    size_t huge = mm_hugepagesize();
+    if (huge != 0){     // end the heap on a huge page boundary, the surplus is freed as usual
+        uintptr_t end = (uintptr_t)(epi + 1) + grow;
+        grow += ((end + huge - 1) & ~(huge - 1)) - end;
+    }
+    if (heap_sbrk(grow) == (void*)-1){
+        if (grow == b_size - top || heap_sbrk(b_size - top) == (void*)-1){    // retry without the surplus
+            return NULL;
+        }
+        grow = b_size - top;
+    }
 
-        return new;
+    size_t* head = epi - top/8;
+    if (top != 0){
+        delete_node(head + 1);
     }
-    else{
-        return NULL;
+    size_t rest = top + grow - b_size;
+    if (rest == 16){    // too small for a free block of its own
+        b_size += 16;
+        rest = 0;
     }
+    *head = set_alloc(b_size) | ((size_t)root->alloc_group << HINT_SHIFT);
+    *(head + b_size/8 - 1) = *head;
+    *(head + (top + grow)/8) = 0x1;     // new epilogue
+
+    if (rest != 0){     // the surplus goes to the free lists
+        count_split(MM_SPLIT_GROW);
+        size_t* rest_head = head + b_size/8;
+        *rest_head = set_alloc(rest);
+        *(rest_head + rest/8 - 1) = *rest_head;
+        free_block(rest_head + 1);
+    }
+    return head + 1;
 }
 
 // attempt to allocate size in current node (malloc). Returns payload address.
 void* insert(size_t* curr, size_t size){
     
-    size_t b_size = align(*curr & 0xfffffffffffffff0); //get size of current block
+    size_t b_size = get_size(curr); //get size of current block
+    size_t hint = *curr & HINT_MASK;    // the remainder of a split stays in the block's group
+    size_t tag = (size_t)heap_root()->alloc_group << HINT_SHIFT;    // the allocated block joins the requester's
 
     if (b_size == size + 16){    // case where size fits exactly in current block (16 bytes)
 
-        *curr = set_alloc(size+16);
+        delete_node(curr+1);    // before the header loses the cached list index
+
+        *curr = set_alloc(size+16) | tag;
 
         size_t* new_foot = curr + (((size)/sizeof(size_t))+1);
         *new_foot = *curr;
 
-        delete_node(curr+1, b_size-16);
-
         return curr+1;
     }
     else if (b_size == size + 32){    // case where size fits exactly in current block (32 bytes)
 
-        *curr = set_alloc(size+32);
+        delete_node(curr+1);
+
+        *curr = set_alloc(size+32) | tag;
 
         size_t* new_foot = curr + (((size+16)/sizeof(size_t))+1);
         *new_foot = *curr;
 
-        delete_node(curr+1, b_size-16);
-
         return curr+1;
     }
     else if (b_size >= size+48){    // case where block size is large enough for size
 
-        *curr = set_alloc(size+16); 
+        delete_node(curr+1); // deletes the DLL node that is being allocated
+
+        *curr = set_alloc(size+16) | tag;
 
         size_t* new_foot = curr + ((size)/8 + 1);   // split at corresponding size
         *new_foot = *curr; 
 
         size_t* new_head = (new_foot + 1);  // new head to be freed
-        *new_head = b_size - size - 16;
+        *new_head = (b_size - size - 16) | hint;
 
         new_foot = curr + ((b_size)/8 -1);
-        *new_foot = *new_head;
+        *new_foot = b_size - size - 16;
 
-        delete_node(curr+1, b_size-16); // deletes the DLL node that has been allocated
+        count_split(MM_SPLIT_MALLOC);
         free(new_head+1);   // frees the remaining space after split-allocate
 
         return curr + 1;
@@ -325,17 +563,22 @@ void* insert(size_t* curr, size_t size){
 // coalesce adjacent free blocks. Returns pointer to new header. Takes in pointers to the current and next headers and sizes.
 size_t* coal(size_t* curr, size_t* next, size_t* size_curr, size_t* size_next){
     size_t comb_size = (*size_next + *size_curr);
-    *curr = comb_size & 0xfffffffffffffff0;
+    *curr = comb_size & SIZE_MASK;
     size_t* next_foot = (next + (*size_next-8)/8);
-    *next_foot = (comb_size & 0xfffffffffffffff0);
+    *next_foot = (comb_size & SIZE_MASK);
 
     return curr;
 }
 
 // add a new node to beginning of DLL - Takes in the pointer and size we want to store in the free list, returns nothing.
 void dll_add_free(size_t* curr, size_t size){
+    free_lists_t* lists = heap_root()->groups[(*curr & HINT_MASK) >> HINT_SHIFT];    // the free lists of the block's group
+    dll_node_t** seg_list = lists->seg_list;
 
     int list_num = find_list(size);
+    *curr = get_size(curr) | (*curr & HINT_MASK) | ((size_t)list_num << CLASS_SHIFT);   // cache the list index for delete_node
+    lists->list_len[list_num]++;
+    heap_root()->free_bytes += get_size(curr);
     
     if (seg_list[list_num] == NULL){    // initialize explicit free list (DLL)
         struct dll_node* new1 = (dll_node_t*)(curr+1);
@@ -360,235 +603,2122 @@ void dll_add_free(size_t* curr, size_t size){
 }
 
 /*
- * malloc
+ * Adaptive size classes
+ * malloc keeps a histogram of small request sizes. Every ADAPT_PERIOD mallocs, a table class that
+ * has gathered a long free list and spans several sizes is split at the median of its recent requests,
+ * and the two adjacent classes that saw the least traffic are merged to free a list for it. Classes are
+ * positions in size order; order[] maps them to seg_list indices, so only the lists of the merged and
+ * the split classes need rebinning, and free blocks elsewhere keep their cached list index.
  */
-void* malloc(size_t size)
-{
-    // IMPLEMENT THIS
 
-    size_t* curr = NULL;
-    size = align(size);
+// moves the blocks of seg list list_num, in every hint group, whose size now maps to another list. Returns nothing.
+static void rebin(int list_num){
+    for (int group = 0; group < HINT_GROUPS; group++){
+        free_lists_t* lists = heap_root()->groups[group];
+        if (lists == NULL){
+            continue;
+        }
+        dll_node_t* node = lists->seg_list[list_num];
+
+        for (uint32_t left = lists->list_len[list_num]; left > 0; left--){
+            dll_node_t* next = node->next;
+            size_t* head = (size_t*)node - 1;
+            size_t size = get_size(head) - 16;
+            if (find_list(size) != list_num){
+                delete_node((size_t*)node);
+                dll_add_free(head, size);
+            }
+            node = next;
+        }
+    }
+}
 
-    int list_num = find_list(size); // find corresponding list index
+// returns the number of free blocks in seg list list_num across all hint groups
+static uint32_t list_len(int list_num){
+    uint32_t len = 0;
+    for (int group = 0; group < HINT_GROUPS; group++){
+        if (heap_root()->groups[group] != NULL){
+            len += heap_root()->groups[group]->list_len[list_num];
+        }
+    }
+    return len;
+}
 
-    // iterate through the segregated lists
-    while (list_num < 15){
-        if (seg_list[list_num] != NULL){
-            curr = (size_t*)(seg_list[list_num]) - 1;
+// splits a hot table class and merges the coldest adjacent pair to make room. Returns nothing.
+static void adapt_classes(void){
+    heap_root_t* root = heap_root();
+    uint32_t hits[SMALL_CLASSES] = {0};
+    int lo[SMALL_CLASSES];  // first bin of each class
+    int hot = -1;
+    int cold = -1;
+
+    for (int bin = SMALL_BINS - 1; bin >= 1; bin--){
+        hits[root->class_map[bin]] += root->size_hist[bin];
+        lo[root->class_map[bin]] = bin;
+    }
 
-            size_t* insertion = insert(curr, size); // attempt to insert at head of current list number
-            if (insertion != NULL){
-                assert(mm_checkheap(__LINE__)==true);
-                return insertion;
-            }
-            
-            if (seg_list[list_num]->next != seg_list[list_num]){    
-                struct dll_node* curr_node = seg_list[list_num]->next;
-                curr = (size_t*)curr_node - 1;
+    // hot: the busiest multi-size class with a long free list
+    for (int class_num = 0; class_num < SMALL_CLASSES; class_num++){
+        int hi = (class_num + 1 < SMALL_CLASSES) ? lo[class_num + 1] - 1 : SMALL_BINS - 1;
+        if (hi > lo[class_num] && list_len(root->order[class_num]) > ADAPT_SPLIT_LEN
+            && (hot < 0 || hits[class_num] > hits[hot])){
+            hot = class_num;
+        }
+    }
+    // cold: the quietest pair of neighbours, not including the hot class
+    for (int class_num = 0; hot >= 0 && class_num + 1 < SMALL_CLASSES; class_num++){
+        if (class_num != hot && class_num + 1 != hot
+            && (cold < 0 || hits[class_num] + hits[class_num + 1] < hits[cold] + hits[cold + 1])){
+            cold = class_num;
+        }
+    }
 
-                while (curr_node != seg_list[list_num]){    // iterate through the current seg list (starting from head->next)
+    if (cold >= 0 && (uint64_t)(hits[cold] + hits[cold + 1]) * ADAPT_RATIO < hits[hot]
+        && hits[hot] >= ADAPT_PERIOD / ADAPT_RATIO){
+        // split point: the median request of the hot class, leaving at least one size above it
+        int hi = (hot + 1 < SMALL_CLASSES) ? lo[hot + 1] - 1 : SMALL_BINS - 1;
+        int mid = lo[hot];
+        for (uint32_t seen = root->size_hist[mid]; mid + 1 < hi && 2 * seen < hits[hot]; seen += root->size_hist[mid]){
+            mid++;
+        }
 
-                    insertion = insert(curr, size);
-                    if (insertion != NULL){
-                        assert(mm_checkheap(__LINE__)==true);   //call to check heap consistency
-                        return insertion;
-                    }
+        // merge cold + 1 into cold, freeing its list
+        int spare = root->order[cold + 1];
+        for (int bin = 1; bin < SMALL_BINS; bin++){
+            root->class_map[bin] -= (root->class_map[bin] > cold);
+        }
+        for (int class_num = cold + 1; class_num + 1 < SMALL_CLASSES; class_num++){
+            root->order[class_num] = root->order[class_num + 1];
+        }
+        hot -= (hot > cold);
 
-                    curr_node = curr_node->next;
-                    curr = (size_t*)curr_node - 1;
-                    }
-            }
+        // split the sizes above mid off the hot class into the spare list
+        for (int bin = 1; bin < SMALL_BINS; bin++){
+            int class_num = root->class_map[bin];
+            root->class_map[bin] = class_num + (class_num > hot || (class_num == hot && bin > mid));
         }
-        list_num = list_num + 1;
-    }
+        for (int class_num = SMALL_CLASSES - 1; class_num > hot + 1; class_num--){
+            root->order[class_num] = root->order[class_num - 1];
+        }
+        root->order[hot + 1] = spare;
 
-    size_t* new = extend_heap(size);
+        rebin(spare);   // still holds the merged class's blocks
+        rebin(root->order[hot]);
+    }
 
-    return new;
+    for (int bin = 0; bin < SMALL_BINS; bin++){
+        root->size_hist[bin] /= 2;
+    }
 }
 
 /*
- * free
+ * Page spans
+ * Blocks of SPAN_MIN_BYTES or more are page-granular spans. A span's metadata is a small
+ * boundary-tagged block of its own, found through a radix tree keyed by page number (the pagemap),
+ * so freeing or resizing a large block never touches its payload. Only the first and last page of
+ * a span are mapped, which is all that lookups by address and coalescing with neighbours need.
+ * Span pages live inside "fences": allocated boundary-tagged blocks wrapping a run of pages, so the
+ * rest of the heap walks over them like any other allocated block. A fence at the top of the heap
+ * grows in place, which keeps consecutive span extensions contiguous.
  */
-void free(void* ptr)
-{
-
-    // IMPLEMENT THIS
-    size_t* curr = ptr;
-    size_t* head = curr-1;
-            
-    size_t b_size = get_size(head); 
-    
-    *head = b_size; // sets to free
-    
-    size_t* foot = curr + ((b_size-16)/8);   // sets footer according to head
-    *foot = b_size; 
-
-    size_t b_size_left = get_size(head-1);
-    size_t* left = curr - b_size_left/8 -1;
-    curr = head;
-    size_t* right = foot +1; 
-
-    size_t alloc_left = *left & 0xf;    // get allocations
-    size_t alloc_curr = *curr & 0xf;
-    size_t alloc_right = *right & 0xf;
 
-    size_t b_size_curr = get_size(curr);    // get sizes
-    size_t b_size_right = get_size(right);
+// returns the epilogue header
+static size_t* epilogue(void){
+    return (size_t*)((char*)mm_heap_hi() + 1) - 1;
+}
 
-    if (alloc_left == 0 && alloc_curr == 0){    // case where we need to coalesce with already-free left block
-        delete_node(left+1, b_size_left-16);
-        curr = coal(left, curr, &b_size_left, &b_size_curr);
-        b_size_curr = get_size(curr);
-        alloc_curr = *curr & 0xf;
-        
-        if (alloc_curr == 0 && alloc_right == 0){   // case where we need to coalesce with already-free right block (left was also free)
-            curr = coal(curr, right, &b_size_curr, &b_size_right);
-            b_size_curr = get_size(curr);
-            delete_node(right+1, b_size_right-16);
-            dll_add_free(curr, b_size_curr-16);
-            return;
-        }
-        else{
-            b_size_curr = get_size(curr);
-            dll_add_free(curr, b_size_curr-16);
-            return;
+// walks the pagemap down to the entry for page. Missing nodes are created if create is set,
+// otherwise NULL is returned for pages that were never mapped.
+static span_t** pagemap_slot(uintptr_t page, bool create){
+    void** slot = (void**)&heap_root()->pagemap;
+    for (int level = PAGEMAP_LEVELS - 1; level >= 0; level--){
+        if (*slot == NULL){
+            if (!create){
+                return NULL;
+            }
+            void* node = malloc(sizeof(void*) << PAGEMAP_BITS);
+            if (node == NULL){
+                return NULL;
+            }
+            memset(node, 0, sizeof(void*) << PAGEMAP_BITS);
+            *slot = node;
         }
+        slot = (void**)*slot + ((page >> (level * PAGEMAP_BITS)) & ((1UL << PAGEMAP_BITS) - 1));
     }
-    if (alloc_curr == 0 && alloc_right == 0){   // case where we need to coalesce with already-free right block (left was not free)
-        b_size_curr = get_size(curr);
-        curr = coal(curr, right, &b_size_curr, &b_size_right);
-        b_size_curr = get_size(curr);
-        delete_node(right+1,b_size_right-16);
-        dll_add_free(curr, b_size_curr-16);
-        return;
-        }
+    return (span_t**)slot;
+}
 
-    dll_add_free(curr, b_size_curr-16); // case for no coalescing
-    return;
+// returns the span whose first or last page is page, if any
+static span_t* span_lookup(uintptr_t page){
+    span_t** slot = pagemap_slot(page, false);
+    return slot == NULL ? NULL : *slot;
 }
 
+// maps the first and last page of span back to it. Returns false if a pagemap node could not be allocated.
+static bool span_register(span_t* span){
+    span_t** first_slot = pagemap_slot(span->start, true);
+    span_t** last_slot = pagemap_slot(span->start + span->npages - 1, true);
+    if (first_slot == NULL || last_slot == NULL){
+        return false;
+    }
+    *first_slot = span;
+    *last_slot = span;
+    return true;
+}
 
-/*
- * realloc
- */
-void* realloc(void* oldptr, size_t size)
-{
-    // IMPLEMENT THIS
+// takes a page count and outputs the index of the corresponding free span list
+static int span_list(size_t npages){
+    int list_num = 63 - __builtin_clzl(npages);
+    return list_num < SPAN_LISTS ? list_num : SPAN_LISTS - 1;
+}
 
-    void* retval;
-    if (oldptr == NULL){    
-        retval = malloc(align(size));
-        return retval;
+// adds a span to the beginning of its free span list
+static void span_push(span_t* span){
+    span_t** head = &heap_root()->free_spans[span_list(span->npages)];
+    span->free = true;
+    span->prev = NULL;
+    span->next = *head;
+    if (*head != NULL){
+        (*head)->prev = span;
+    }
+    *head = span;
+}
+
+// takes a span off its free span list
+static void span_remove(span_t* span){
+    if (span->prev != NULL){
+        span->prev->next = span->next;
     }
-    if (size == 0){
-        free(oldptr);
-        return oldptr;
-        }
     else{
-        size = align(size);
+        heap_root()->free_spans[span_list(span->npages)] = span->next;
+    }
+    if (span->next != NULL){
+        span->next->prev = span->prev;
+    }
+    span->free = false;
+}
 
-        size_t* og_head = (size_t*)oldptr -1;   // get header and footer sizes, allocations
-        size_t og_size = get_size(og_head);
-        size_t* og_foot = og_head + (og_size-16)/8 + 1;
+// merges right into span, its left neighbour, and frees right's metadata
+static void span_absorb(span_t* span, span_t* right){
+    *pagemap_slot(span->start + span->npages - 1, false) = NULL;    // the old boundary is now interior
+    *pagemap_slot(right->start, false) = NULL;
+    span->npages += right->npages;
+    span->released = span->released && right->released;
+    span->zeroed = span->zeroed && right->zeroed;
+    *pagemap_slot(span->start, false) = span;
+    *pagemap_slot(span->start + span->npages - 1, false) = span;
+    free(right);
+}
 
-        size_t* og_next = og_foot + 1;
-        size_t og_next_size = get_size(og_next);
-        size_t* og_next_foot = og_next + (og_next_size-16)/8 + 1;
-        size_t og_next_alloc = *og_next & 0xf;
+// splits span after its first npages pages. Returns the new tail span, which is in no list, or NULL
+// if there is nothing to split off or its metadata could not be allocated (span is then unchanged).
+static span_t* span_split(span_t* span, size_t npages){
+    span_t* tail;
+    if (span->npages == npages || (tail = malloc(sizeof(span_t))) == NULL){
+        return NULL;
+    }
+    tail->start = span->start + npages;
+    tail->npages = span->npages - npages;
+    tail->free = false;
+    tail->released = span->released;
+    tail->zeroed = span->zeroed;
+    span->npages = npages;
+
+    if (!span_register(span) || !span_register(tail)){
+        span->npages += tail->npages;
+        free(tail);
+        return NULL;
+    }
+    return tail;
+}
 
-        if (size+16 == og_size){    // case where size fits exactly in previously allocated block (16 bytes)
+// adds a span to the free span lists, coalescing it with free neighbours. Returns the merged span.
+static span_t* span_coalesce(span_t* span){
+    span_t* left = span_lookup(span->start - 1);
+    span_t* right = span_lookup(span->start + span->npages);
 
-            *og_head = *og_head | 0x1;   // set head to allocated
-            *og_foot = *og_head;    // match header and footer
-            
-            return og_head + 1;
-        }
+    if (left != NULL && left->free){
+        span_remove(left);
+        span_absorb(left, span);
+        span = left;
+    }
+    if (right != NULL && right->free){
+        span_remove(right);
+        span_absorb(span, right);
+    }
+    span_push(span);
+    return span;
+}
 
-        if (size+32 == og_size){    // case where size fits exactly in previously allocated block (16 bytes)
-            
-            *og_head = *og_head | 0x1;   // set head to allocated
-            *og_foot = *og_head;    // match header and footer
-            
-            return og_head + 1;
+// frees a span, handing its pages back to the OS once enough free pages have gathered around it.
+// With huge pages only the huge pages the span covers entirely go back, partly used ones stay whole.
+static void span_free(span_t* span){
+    span = span_coalesce(span);
+    if (!span->released && span->npages >= SPAN_RELEASE_PAGES){
+        uintptr_t lo = span->start << PAGE_SHIFT;
+        uintptr_t hi = lo + (span->npages << PAGE_SHIFT);
+        size_t huge = mm_hugepagesize();
+        if (huge != 0){
+            lo = (lo + huge - 1) & ~(huge - 1);
+            hi &= ~(huge - 1);
         }
-        else if(size+48 <= og_size){    // case where previously allocated block is enough for size
-
-            *og_head = (size+16) | 0x0000000000000001;
-            size_t* new_foot = og_head + size/8 + 1;
-            *new_foot = *og_head;   // split the space 
-            size_t* new_head = new_foot + 1;
-            *new_head = (og_size - 16 - size);
-            *og_foot = *new_head;
-
-            free(new_head+1);
-
-            return og_head +1;
+        if (lo < hi && mm_release((void*)lo, hi - lo) == 0){
+            span->released = true;
+            span->zeroed = (lo == span->start << PAGE_SHIFT && hi == (span->start + span->npages) << PAGE_SHIFT);
         }
-        else{   
-            if (og_size + og_next_size == size + 16 && og_next_alloc == 0){     // case where size fits perfect in curr + next
-
-                delete_node(og_next+1, og_next_size-16);
+    }
+}
 
-                *og_head = (size+16) | 0x0000000000000001;
-                *og_next_foot = *og_head;
-                
-                return og_head + 1;
-            }
-            if (og_size + og_next_size == size + 32 && og_next_alloc == 0){     // case where size fits perfect in curr + next
+// with huge pages, rounds up the size of npages span pages starting at pages so that the heap ends in the
+// last small page before a huge page boundary, after the fence footer and epilogue
+static size_t span_huge_round(const char* pages, size_t npages){
+    size_t huge = mm_hugepagesize();
+    if (huge == 0){
+        return npages;
+    }
+    uintptr_t end = ((uintptr_t)pages + (npages << PAGE_SHIFT) + 16 + huge - 1) & ~(huge - 1);
+    return (end - PAGE_BYTES - (uintptr_t)pages) >> PAGE_SHIFT;
+}
 
-                delete_node(og_next+1, og_next_size-16);
+// returns the page number just past the last span of the fence at the top of the heap,
+// or 0 if the top of the heap is not a fence
+static uintptr_t span_top_page(void){
+    size_t* fence = heap_root()->fence;
+    size_t* epi = epilogue();
+    if (fence == NULL || fence + get_size(fence)/8 != epi){
+        return 0;
+    }
+    return (uintptr_t)(epi - 1) >> PAGE_SHIFT;    // the fence footer starts on a page boundary
+}
 
-                *og_head = (size+32) | 0x0000000000000001;
-                *og_next_foot = *og_head;
-                
-                return og_head + 1;
-            }
-            if (og_size + og_next_size - 16 > size && og_next_alloc == 0){      // case where curr + next is enough for size
-                
-                *og_head = (size+16) | 0x0000000000000001;  
-                size_t* new_foot = og_head + size/8 + 1;
+// extends the heap by npages pages of span memory, or a few more with huge pages. Returns the new free
+// span, coalesced with a free span below it, or NULL if the heap cannot grow.
+static span_t* span_grow(size_t npages){
+    span_t* span = malloc(sizeof(span_t));    // may extend the heap, so look at the top afterwards
+    if (span == NULL){
+        return NULL;
+    }
 
-                delete_node(og_next+1, og_next_size - 16);
-                *new_foot = *og_head;
-                size_t* new_head = new_foot + 1;
-                
-                *new_head = (og_size + og_next_size - 16 - size);
-                *og_next_foot = *new_head;
+    size_t* epi = epilogue();
+    size_t* fence = heap_root()->fence;
+    size_t gap = 0;
+    char* pages;
+    char* fresh = mm_heap_fresh();  // heap memory from here up has never been written
+
+    if (span_top_page() != 0){    // grow the top fence in place, its footer moves up
+        pages = (char*)(epi - 1);
+        npages = span_huge_round(pages, npages);
+        if (heap_sbrk(npages << PAGE_SHIFT) == (void*)-1){
+            free(span);
+            return NULL;
+        }
+        *fence = set_alloc(get_size(fence) + (npages << PAGE_SHIFT)) | FENCE;
+    }
+    else{   // start a new fence at the next page boundary
+        pages = (char*)(((uintptr_t)(epi + 1) + PAGE_BYTES - 1) & ~(PAGE_BYTES - 1));
+        npages = span_huge_round(pages, npages);
+        gap = pages - 8 - (char*)epi;   // bytes between the old epilogue and a header just below pages
+        if (heap_sbrk(pages + (npages << PAGE_SHIFT) + 16 - (char*)(epi + 1)) == (void*)-1){
+            free(span);
+            return NULL;
+        }
+        fence = (gap >= 32) ? (size_t*)(pages - 8) : epi;
+        *fence = set_alloc(pages + (npages << PAGE_SHIFT) + 8 - (char*)fence) | FENCE;
+        heap_root()->fence = fence;
+    }
 
-                free(new_head + 1);
+    size_t* foot = (size_t*)(pages + (npages << PAGE_SHIFT));
+    *foot = *fence;
+    *(foot + 1) = 0x1;  // new epilogue
 
-                return og_head + 1;
-            }
-            else{   // create new space and move all existing data to this new space, then free previously allocated block
+    if (gap >= 32){     // the bytes below the new fence become an ordinary free block
+        *epi = gap;
+        *(size_t*)(pages - 16) = gap;
+        free(epi + 1);
+    }
 
-                size_t* retval = extend_heap(size);
+    span->start = (uintptr_t)pages >> PAGE_SHIFT;
+    span->npages = npages;
+    span->released = true;  // fresh pages have never been touched
+    span->zeroed = (pages >= fresh);    // unless the heap was reset below them
+    span->free = false;
+    if (!span_register(span)){
+        free(span);
+        return NULL;
+    }
+    return span_coalesce(span);
+}
 
-                memcpy(retval, og_head + 1, og_size-16);
-                
-                free(oldptr);
+// allocates a span of npages pages, growing the heap if no free span is large enough. If zeroed is not
+// NULL, it is set to whether the pages are known to read as zero.
+static span_t* span_alloc(size_t npages, bool* zeroed){
+    span_t* span = NULL;
 
-                return retval;
-                
+    while (span == NULL){
+        for (int list_num = span_list(npages); list_num < SPAN_LISTS && span == NULL; list_num++){
+            span = heap_root()->free_spans[list_num];
+            while (span != NULL && span->npages < npages){    // first fit within the list
+                span = span->next;
+            }
+        }
+        if (span == NULL){  // only grow by what a free span at the top of the heap is missing
+            uintptr_t top_page = span_top_page();
+            span_t* top = (top_page != 0) ? span_lookup(top_page - 1) : NULL;
+            size_t have = (top != NULL && top->free) ? top->npages : 0;
+            if (span_grow(npages - have) == NULL){
+                return NULL;
             }
         }
     }
-    return NULL;
+
+    span_remove(span);
+    span_t* tail = span_split(span, npages);
+    if (tail != NULL){
+        span_push(tail);    // the right neighbour of a free span is never free
+    }
+    if (zeroed != NULL){
+        *zeroed = span->zeroed;
+    }
+    span->zeroed = false;   // the caller is about to write to the pages, so free has to release them again
+    span->released = false;
+    return span;
 }
 
-/*
- * calloc
- * This function is not tested by mdriver, and has been implemented for you.
- */
-void* calloc(size_t nmemb, size_t size)
-{
-    void* ptr;
-    size *= nmemb;
-    ptr = malloc(size);
-    if (ptr) {
-        memset(ptr, 0, size);
+// returns the in-use span whose payload starts at ptr, or NULL for boundary-tagged blocks
+static span_t* span_of(const void* ptr){
+    if (((uintptr_t)ptr & (PAGE_BYTES - 1)) != 0 || heap_root()->pagemap == NULL){
+        return NULL;
     }
-    return ptr;
+    span_t* span = span_lookup((uintptr_t)ptr >> PAGE_SHIFT);
+    return (span != NULL && !span->free) ? span : NULL;
+}
+
+// grows an in-use span to npages pages in place, into the free pages on the right, making some at the
+// top of the heap if needed. Returns false if the span cannot grow that far.
+static bool span_expand(span_t* span, size_t npages){
+    span_t* right = span_lookup(span->start + span->npages);
+    if ((right == NULL || !right->free) && span->start + span->npages == span_top_page()){
+        right = span_grow(npages - span->npages);
+    }
+    if (right == NULL || !right->free || right->start != span->start + span->npages
+        || span->npages + right->npages < npages){
+        return false;
+    }
+
+    span_remove(right);
+    span_t* tail = span_split(right, npages - span->npages);
+    if (tail != NULL){
+        span_push(tail);
+    }
+    span_absorb(span, right);
+    return true;
+}
+
+// realloc for blocks that are, or are about to become, spans. span is NULL if oldptr is boundary-tagged.
+static void* span_realloc(void* oldptr, span_t* span, size_t size){
+    size_t npages = (size + PAGE_BYTES - 1) >> PAGE_SHIFT;
+
+    if (span != NULL && size >= SPAN_MIN_BYTES){
+        if (npages <= span->npages){    // shrink in place, the tail pages go back to the page heap
+            span_t* tail = span_split(span, npages);
+            if (tail != NULL){
+                span_free(tail);
+            }
+            count_realloc(MM_REALLOC_IN_PLACE, 0);
+            return oldptr;
+        }
+        if (span_expand(span, npages)){
+            count_realloc(MM_REALLOC_IN_PLACE, 0);
+            return oldptr;
+        }
+    }
+
+    // create new space and move the data, then free the old block
+    void* newptr = malloc(size);
+    if (newptr == NULL){
+        return NULL;
+    }
+    size_t old_size = (span != NULL) ? span->npages << PAGE_SHIFT : get_size((size_t*)oldptr - 1) - 16;
+    memcpy(newptr, oldptr, old_size < size ? old_size : size);
+    count_realloc(MM_REALLOC_MOVED, old_size < size ? old_size : size);
+    free(oldptr);
+    return newptr;
+}
+
+/*
+ * Mapped blocks
+ * Huge blocks live outside the heap, each in a memlib mapping of its own with a map_block_t in front
+ * of the payload. free unmaps them right away, and realloc resizes them with mremap, which moves page
+ * mappings instead of copying the payload, so growing a buffer costs the same at any size. Mapping is
+ * not free either: every new mapping faults its pages in again. Like glibc's mmap threshold, the size
+ * from which malloc maps a block starts at MAP_MIN_BYTES and rises to the size of each mapped block
+ * that is freed (up to MAP_MAX_BYTES), so blocks that are allocated and freed over and over settle in
+ * page spans, while blocks that grow through realloc stay mapped. The blocks of a heap are kept in a
+ * list so that destroying the heap can unmap them.
+ */
+
+// tells whether ptr is the payload of a mapped block, which is the only kind outside the heap
+static bool is_mapped(const void* ptr){
+    return (const char*)ptr < (const char*)mm_heap_lo() || (const char*)ptr > (const char*)mm_heap_hi();
+}
+
+// maps a block of size bytes. Returns the payload, or NULL if the mapping failed or size is too large to map.
+static void* map_alloc(size_t size){
+    if (size > SIZE_MAX - sizeof(map_block_t) - PAGE_BYTES){  // the header and the page round-up would wrap
+        errno = ENOMEM;
+        return NULL;
+    }
+    map_block_t* block = mm_mmap(sizeof(map_block_t) + size);
+    if (block == NULL){
+        return NULL;
+    }
+    heap_root_t* root = heap_root();
+    block->len = (sizeof(map_block_t) + size + PAGE_BYTES - 1) & ~(PAGE_BYTES - 1);
+    block->prev = NULL;
+    block->next = root->mapped;
+    if (root->mapped != NULL){
+        root->mapped->prev = block;
+    }
+    root->mapped = block;
+    return block + 1;
+}
+
+// points the neighbours of block in the mapped list at it, after mremap has moved it
+static void map_relink(map_block_t* block){
+    if (block->prev != NULL){
+        block->prev->next = block;
+    }
+    else{
+        heap_root()->mapped = block;
+    }
+    if (block->next != NULL){
+        block->next->prev = block;
+    }
+}
+
+// unmaps the mapped block with payload ptr, and keeps blocks of its size in the heap from now on
+static void map_free(void* ptr){
+    map_block_t* block = (map_block_t*)ptr - 1;
+    heap_root_t* root = heap_root();
+    if (block->len > root->map_min){
+        root->map_min = (block->len < MAP_MAX_BYTES) ? block->len : MAP_MAX_BYTES;
+    }
+    if (block->prev != NULL){
+        block->prev->next = block->next;
+    }
+    else{
+        heap_root()->mapped = block->next;
+    }
+    if (block->next != NULL){
+        block->next->prev = block->prev;
+    }
+    mm_munmap(block, block->len);
+}
+
+// resizes the mapped block with payload ptr to hold size bytes. It moves only if may_move is set.
+// Returns the payload, or NULL if the mapping could not be resized (the block is then unchanged).
+static void* map_resize(void* ptr, size_t size, bool may_move){
+    if (size > SIZE_MAX - sizeof(map_block_t) - PAGE_BYTES){
+        errno = ENOMEM;
+        return NULL;
+    }
+    map_block_t* block = (map_block_t*)ptr - 1;
+    size_t len = (sizeof(map_block_t) + size + PAGE_BYTES - 1) & ~(PAGE_BYTES - 1);
+    if (len == block->len){
+        return ptr;
+    }
+    block = mm_mremap(block, block->len, len, may_move);
+    if (block == NULL){
+        return NULL;
+    }
+    block->len = len;
+    map_relink(block);
+    return block + 1;
+}
+
+// realloc for mapped blocks: stays mapped down to MAP_MIN_BYTES, below that it moves back into the heap
+static void* map_realloc(void* oldptr, size_t size){
+    if (size >= MAP_MIN_BYTES){
+        void* newptr = map_resize(oldptr, size, true);
+        if (newptr != NULL){
+            count_realloc(MM_REALLOC_REMAPPED, 0);
+        }
+        return newptr;
+    }
+    void* newptr = malloc(size);
+    if (newptr == NULL){
+        return NULL;
+    }
+    memcpy(newptr, oldptr, size);
+    count_realloc(MM_REALLOC_MOVED, size);
+    map_free(oldptr);
+    return newptr;
+}
+
+/*
+ * mm_set_probe_limit
+ * Bounds the free blocks one malloc inspects, over all size classes and hint groups; once the limit is hit,
+ * malloc extends the heap instead. 0 removes the bound.
+ */
+void mm_set_probe_limit(size_t limit)
+{
+    probe_limit = limit;
+}
+
+/*
+ * mm_probe_stats
+ * Reports the largest and the 99th percentile number of free blocks inspected by a malloc since mm_init.
+ */
+void mm_probe_stats(size_t* max, size_t* p99)
+{
+    heap_root_t* root = heap_root();
+    size_t total = 0;
+    for (int probes = 0; probes < PROBE_HIST; probes++){
+        total += root->probe_hist[probes];
+    }
+
+    size_t seen = 0;
+    int probes = 0;
+    while (probes < PROBE_HIST - 1 && (seen += root->probe_hist[probes]) * 100 < total * 99){
+        probes++;
+    }
+    *max = root->probe_max;
+    *p99 = probes;
+}
+
+// records the number of free blocks one malloc inspected. Returns nothing.
+static void count_probes(size_t probes){
+    heap_root_t* root = heap_root();
+    root->probe_hist[probes < PROBE_HIST ? probes : PROBE_HIST - 1]++;
+    root->probe_max = probes > root->probe_max ? probes : root->probe_max;
+}
+
+#ifdef MM_STATS
+/*
+ * mm_stats
+ * Fills in the statistics of the heap in use. Byte counts, free blocks and spans come from a walk over the
+ * heap, the probe histogram from malloc's own, and the rest from the counters since mm_init.
+ */
+void mm_stats(mm_stats_t* stats)
+{
+    heap_root_t* root = heap_root();
+    memset(stats, 0, sizeof(mm_stats_t));
+
+    unsigned char class_of[NUM_CLASSES];    // seg_list index -> class, the inverse of order
+    for (int class_num = 0; class_num < NUM_CLASSES; class_num++){
+        class_of[root->order[class_num]] = class_num;
+    }
+    stats->classes = NUM_CLASSES;
+
+    size_t* curr = first + sizeof(heap_root_t) + 8;    // the prologue
+    while (*curr != 0x1){
+        size_t b_size = get_size(curr);
+        if ((*curr & 0xf) == 0){
+            int class_num = class_of[(*curr >> CLASS_SHIFT) & LIST_BITS];
+            stats->free_blocks[class_num]++;
+            stats->free_class_bytes[class_num] += b_size;
+            stats->free_bytes += b_size;
+        }
+        else if (*curr & FENCE){   // the spans tile the fence's pages
+            uintptr_t page = ((uintptr_t)(curr + 1) + PAGE_BYTES - 1) >> PAGE_SHIFT;
+            uintptr_t end = (uintptr_t)(curr + b_size/8 - 1) >> PAGE_SHIFT;
+            span_t* span;
+            while (page < end && (span = span_lookup(page)) != NULL && span->start == page){
+                if (span->free){
+                    stats->free_spans++;
+                    stats->free_bytes += span->npages << PAGE_SHIFT;
+                }
+                else{
+                    stats->live_bytes += span->npages << PAGE_SHIFT;
+                }
+                page += span->npages;
+            }
+        }
+        else if ((*curr & PINNED) == 0){
+            stats->live_bytes += b_size - 16;
+        }
+        curr += b_size/8;
+    }
+
+    stats->heap_bytes = mm_heapsize();
+    for (map_block_t* block = root->mapped; block != NULL; block = block->next){
+        stats->heap_bytes += block->len;
+        stats->live_bytes += block->len - sizeof(map_block_t);
+    }
+
+    stats->mallocs = root->mallocs;
+    for (int probes = 0; probes < PROBE_HIST; probes++){
+        int bucket = (probes == 0) ? 0 : 64 - __builtin_clzl(probes);
+        stats->probes[bucket < MM_STATS_PROBE_BUCKETS ? bucket : MM_STATS_PROBE_BUCKETS - 1] += root->probe_hist[probes];
+    }
+    stats->probe_max = root->probe_max;
+
+    stats->sbrk_calls = root->stats.sbrk_calls;
+    stats->sbrk_bytes = root->stats.sbrk_bytes;
+    memcpy(stats->splits, root->stats.splits, sizeof(stats->splits));
+    memcpy(stats->coalesces, root->stats.coalesces, sizeof(stats->coalesces));
+    memcpy(stats->reallocs, root->stats.reallocs, sizeof(stats->reallocs));
+    stats->realloc_copied = root->stats.realloc_copied;
+}
+#endif
+
+// first fit for size in one set of free lists, walking the classes in increasing size order.
+// Adds the free blocks inspected to *probes, stopping once it reaches the probe limit.
+// Returns the payload address, or NULL if nothing fits.
+static void* find_fit(free_lists_t* lists, size_t size, size_t* probes){
+    dll_node_t** seg_list = lists->seg_list;
+    heap_root_t* root = heap_root();
+    size_t* curr = NULL;
+
+    int class_num = find_class(size); // find corresponding size class
+
+    // iterate through the segregated lists, in increasing size order
+    while (class_num < NUM_CLASSES && (probe_limit == 0 || *probes < probe_limit)){
+        int list_num = root->order[class_num];
+        if (seg_list[list_num] != NULL){
+            curr = (size_t*)(seg_list[list_num]) - 1;
+            (*probes)++;
+
+            size_t* insertion = insert(curr, size); // attempt to insert at head of current list number
+            if (insertion != NULL){
+                return insertion;
+            }
+            
+            if (seg_list[list_num]->next != seg_list[list_num]){    
+                struct dll_node* curr_node = seg_list[list_num]->next;
+                curr = (size_t*)curr_node - 1;
+
+                // iterate through the current seg list (starting from head->next), up to the probe limit
+                while (curr_node != seg_list[list_num] && (probe_limit == 0 || *probes < probe_limit)){
+                    (*probes)++;
+
+                    insertion = insert(curr, size);
+                    if (insertion != NULL){
+                        return insertion;
+                    }
+
+                    curr_node = curr_node->next;
+                    curr = (size_t*)curr_node - 1;
+                    }
+            }
+        }
+        class_num = class_num + 1;
+    }
+    return NULL;
+}
+
+// allocates a boundary-tagged block of size bytes (aligned) from the free lists, the requester's hint group
+// first and then the other groups, and grows the heap only when none of them has a fit. Returns payload address.
+static void* alloc_block(size_t size, size_t* probes){
+    heap_root_t* root = heap_root();
+    for (int pass = 0; pass < HINT_GROUPS; pass++){
+        int group = (pass == 0) ? root->alloc_group : pass - (pass <= root->alloc_group);
+        if (root->groups[group] != NULL){
+            void* insertion = find_fit(root->groups[group], size, probes);
+            if (insertion != NULL){
+                assert(mm_checkheap(__LINE__)==true);   //call to check heap consistency
+                return insertion;
+            }
+        }
+    }
+    return extend_heap(size, probe_limit != 0 && *probes >= probe_limit);
+}
+
+/*
+ * malloc
+ * Fails with ENOMEM for sizes no heap could hold, before align() could wrap them around to a small block.
+ */
+void* malloc(size_t size)
+{
+    // IMPLEMENT THIS
+
+    if (size > MAX_REQUEST_BYTES){
+        errno = ENOMEM;
+        return NULL;
+    }
+    size = align(size > 0 ? size : 1);  // malloc(0) still returns a block that can be freed
+
+    if (size >= heap_root()->map_min){  // huge blocks get a mapping of their own
+        return map_alloc(size);
+    }
+    if (size >= SPAN_MIN_BYTES){    // large blocks are page spans
+        span_t* span = span_alloc((size + PAGE_BYTES - 1) >> PAGE_SHIFT, NULL);
+        return (span != NULL) ? (void*)(span->start << PAGE_SHIFT) : NULL;
+    }
+
+    heap_root_t* root = heap_root();
+    if (size <= SMALL_CLASS_MAX){
+        root->size_hist[size >> 4]++;
+    }
+    if (++root->mallocs % ADAPT_PERIOD == 0){
+        adapt_classes();
+    }
+
+    size_t probes = 0;  // free blocks inspected
+    void* new = alloc_block(size, &probes);
+    count_probes(probes);
+
+    return new;
+}
+
+// frees a boundary-tagged block, coalescing it with free neighbours. Returns nothing.
+static void free_block(void* ptr){
+    size_t* curr = ptr;
+    size_t* head = curr-1;
+            
+    size_t b_size = get_size(head); 
+    size_t hint = *head & HINT_MASK;    // the free block, coalesced or not, stays in the block's group
+    
+    *head = b_size | hint; // sets to free
+    
+    size_t* foot = curr + ((b_size-16)/8);   // sets footer according to head
+    *foot = b_size; 
+
+    size_t b_size_left = get_size(head-1);
+    size_t* left = curr - b_size_left/8 -1;
+    curr = head;
+    size_t* right = foot +1; 
+
+    size_t alloc_left = *left & 0xf;    // get allocations
+    size_t alloc_curr = *curr & 0xf;
+    size_t alloc_right = *right & 0xf;
+
+    size_t b_size_curr = get_size(curr);    // get sizes
+    size_t b_size_right = get_size(right);
+
+    if (alloc_left == 0 && alloc_curr == 0){    // case where we need to coalesce with already-free left block
+        delete_node(left+1);
+        curr = coal(left, curr, &b_size_left, &b_size_curr);
+        *curr |= hint;
+        b_size_curr = get_size(curr);
+        alloc_curr = *curr & 0xf;
+        
+        if (alloc_curr == 0 && alloc_right == 0){   // case where we need to coalesce with already-free right block (left was also free)
+            curr = coal(curr, right, &b_size_curr, &b_size_right);
+            *curr |= hint;
+            b_size_curr = get_size(curr);
+            delete_node(right+1);
+            dll_add_free(curr, b_size_curr-16);
+            count_coalesce(MM_COALESCE_BOTH);
+            return;
+        }
+        else{
+            count_coalesce(MM_COALESCE_LEFT);
+            b_size_curr = get_size(curr);
+            dll_add_free(curr, b_size_curr-16);
+            return;
+        }
+    }
+    if (alloc_curr == 0 && alloc_right == 0){   // case where we need to coalesce with already-free right block (left was not free)
+        b_size_curr = get_size(curr);
+        curr = coal(curr, right, &b_size_curr, &b_size_right);
+        *curr |= hint;
+        b_size_curr = get_size(curr);
+        delete_node(right+1);
+        dll_add_free(curr, b_size_curr-16);
+        count_coalesce(MM_COALESCE_RIGHT);
+        return;
+        }
+
+    dll_add_free(curr, b_size_curr-16); // case for no coalescing
+    count_coalesce(MM_COALESCE_NONE);
+    return;
+}
+
+/*
+ * free
+ */
+void free(void* ptr)
+{
+
+    // IMPLEMENT THIS
+    if (ptr == NULL){
+        return;
+    }
+
+    if (is_mapped(ptr)){    // huge blocks are unmapped right away
+        map_free(ptr);
+        return;
+    }
+    span_t* span = span_of(ptr);
+    if (span != NULL){  // large blocks go back to the page heap
+        span_free(span);
+        return;
+    }
+    free_block(ptr);
+}
+
+/*
+ * malloc_usable_size
+ * Returns the number of bytes the block at ptr can hold, which may be more than was asked for.
+ */
+size_t malloc_usable_size(void* ptr)
+{
+    if (ptr == NULL){
+        return 0;
+    }
+
+    if (is_mapped(ptr)){
+        return ((map_block_t*)ptr - 1)->len - sizeof(map_block_t);
+    }
+    span_t* span = span_of(ptr);
+    if (span != NULL){
+        return span->npages << PAGE_SHIFT;
+    }
+    return get_size((size_t*)ptr - 1) - 16;
+}
+
+/*
+ * free_sized
+ * free for a block from malloc, calloc or realloc whose requested size the caller still knows. The size
+ * tells spans from boundary-tagged blocks, so the pagemap is only consulted for spans.
+ */
+void free_sized(void* ptr, size_t size)
+{
+    if (ptr == NULL){
+        return;
+    }
+    dbg_assert(malloc_usable_size(ptr) >= size);
+
+    if (align(size) >= MAP_MIN_BYTES && is_mapped(ptr)){
+        map_free(ptr);
+        return;
+    }
+    if (align(size) >= SPAN_MIN_BYTES){
+        span_free(span_lookup((uintptr_t)ptr >> PAGE_SHIFT));
+        return;
+    }
+    free_block(ptr);
+}
+
+/*
+ * free_aligned_sized
+ * free_sized for a block from memalign, posix_memalign or aligned_alloc.
+ */
+void free_aligned_sized(void* ptr, size_t alignment, size_t size)
+{
+    if (ptr == NULL){
+        return;
+    }
+    dbg_assert(malloc_usable_size(ptr) >= size);
+
+    if (alignment <= ALIGNMENT && align(size) >= MAP_MIN_BYTES && is_mapped(ptr)){   // memalign passed it on to malloc
+        map_free(ptr);
+        return;
+    }
+    // memalign's own test for serving the request from a span
+    if (align(size) >= SPAN_MIN_BYTES
+        || (alignment > ALIGNMENT && align(size > 0 ? size : 1) + alignment + 16 >= SPAN_MIN_BYTES)){
+        span_free(span_lookup((uintptr_t)ptr >> PAGE_SHIFT));
+        return;
+    }
+    free_block(ptr);
+}
+
+
+// grows the allocated block at head in place to a block size between min_size and max_size, taking in a
+// free right neighbour and, if grow_heap is set and the block ends the heap, new heap space. Blocks stay
+// below SPAN_MIN_BYTES. Returns the new block size, or 0 (block unchanged) if min_size cannot be reached.
+static size_t expand_block(size_t* head, size_t min_size, size_t max_size, bool grow_heap){
+    size_t b_size = get_size(head);
+    size_t hint = *head & HINT_MASK;
+    size_t* right = head + b_size/8;
+    size_t right_size = ((*right & 0xf) == 0) ? get_size(right) : 0;
+    bool at_top = grow_heap && right + right_size/8 == epilogue();
+    size_t avail = b_size + right_size;     // bytes the block can cover without growing the heap
+
+    max_size = (max_size < SPAN_MIN_BYTES) ? max_size : SPAN_MIN_BYTES - ALIGNMENT;
+    if (min_size > max_size || (avail < min_size && !at_top)){
+        return 0;
+    }
+
+    size_t target = (avail < max_size && !at_top) ? avail : max_size;
+    if (target > avail){    // the block ends the heap: grow the heap under it
+        if (heap_sbrk(target - avail) == (void*)-1){
+            if (avail < min_size){
+                return 0;
+            }
+            target = avail;
+        }
+        else{
+            *(head + target/8) = 0x1;   // new epilogue
+            avail = target;
+        }
+    }
+    if (right_size != 0){
+        delete_node(right + 1);
+    }
+
+    size_t rest = avail - target;
+    if (rest == 16){    // too small for a free block of its own
+        target += 16;
+        rest = 0;
+    }
+    *head = set_alloc(target) | hint;
+    *(head + target/8 - 1) = *head;
+    if (rest != 0){     // give back what the block does not need
+        count_split(MM_SPLIT_EXPAND);
+        size_t* rest_head = head + target/8;
+        *rest_head = set_alloc(rest) | hint;
+        *(rest_head + rest/8 - 1) = *rest_head;
+        free_block(rest_head + 1);
+    }
+    return target;
+}
+
+/*
+ * mm_try_expand
+ * Grows the block at ptr in place to hold at least min_size and at most max_size bytes, without ever moving
+ * it. Returns the usable size afterwards, which is below min_size if the block could not grow enough.
+ */
+size_t mm_try_expand(void* ptr, size_t min_size, size_t max_size)
+{
+    if (ptr == NULL){
+        return 0;
+    }
+    max_size = (max_size > min_size) ? max_size : min_size;
+
+    // aim for max_size, and settle for min_size if that is out of reach
+    if (is_mapped(ptr)){    // grows only if the pages after the mapping are free
+        size_t usable = malloc_usable_size(ptr);
+        if (usable < max_size && map_resize(ptr, align(max_size), false) == NULL && usable < min_size){
+            map_resize(ptr, align(min_size), false);
+        }
+        return malloc_usable_size(ptr);
+    }
+    span_t* span = span_of(ptr);
+    if (span != NULL){
+        size_t min_pages = (min_size + PAGE_BYTES - 1) >> PAGE_SHIFT;
+        size_t max_pages = (max_size + PAGE_BYTES - 1) >> PAGE_SHIFT;
+        if (span->npages < max_pages && !span_expand(span, max_pages) && span->npages < min_pages){
+            span_expand(span, min_pages);
+        }
+        return span->npages << PAGE_SHIFT;
+    }
+
+    size_t* head = (size_t*)ptr - 1;
+    size_t b_size = get_size(head);
+    if (b_size - 16 < max_size){   // a block that already holds min_size grows as far as it can towards max_size
+        size_t min_block = align(min_size) + 16;
+        expand_block(head, min_block > b_size ? min_block : b_size, align(max_size) + 16, true);
+    }
+    return get_size(head) - 16;
+}
+
+/*
+ * realloc
+ * Sizes no heap could hold fail with ENOMEM and leave the block as it was.
+ */
+void* realloc(void* oldptr, size_t size)
+{
+    // IMPLEMENT THIS
+
+    if (size > MAX_REQUEST_BYTES){
+        errno = ENOMEM;
+        return NULL;
+    }
+    void* retval;
+    if (oldptr == NULL){    
+        retval = malloc(align(size));
+        return retval;
+    }
+    if (size == 0){
+        free(oldptr);
+        return NULL;
+        }
+    else{
+        size = align(size);
+
+        if (is_mapped(oldptr)){
+            return map_realloc(oldptr, size);
+        }
+        span_t* span = span_of(oldptr);
+        if (span != NULL || size >= SPAN_MIN_BYTES){
+            return span_realloc(oldptr, span, size);
+        }
+
+        size_t* og_head = (size_t*)oldptr -1;   // get header and footer sizes, allocations
+        size_t og_size = get_size(og_head);
+        size_t* og_foot = og_head + (og_size-16)/8 + 1;
+
+        if (size+16 == og_size){    // case where size fits exactly in previously allocated block (16 bytes)
+
+            *og_head = *og_head | 0x1;   // set head to allocated
+            *og_foot = *og_head;    // match header and footer
+            count_realloc(MM_REALLOC_IN_PLACE, 0);
+
+            return og_head + 1;
+        }
+
+        if (size+32 == og_size){    // case where size fits exactly in previously allocated block (16 bytes)
+            
+            *og_head = *og_head | 0x1;   // set head to allocated
+            *og_foot = *og_head;    // match header and footer
+            count_realloc(MM_REALLOC_IN_PLACE, 0);
+
+            return og_head + 1;
+        }
+        else if(size+48 <= og_size){    // case where previously allocated block is enough for size
+
+            size_t hint = *og_head & HINT_MASK;  // both parts stay in the block's hint group
+            *og_head = (size+16) | 0x0000000000000001 | hint;
+            size_t* new_foot = og_head + size/8 + 1;
+            *new_foot = *og_head;   // split the space 
+            size_t* new_head = new_foot + 1;
+            *new_head = (og_size - 16 - size) | hint;
+            *og_foot = *new_head;
+
+            count_split(MM_SPLIT_REALLOC);
+            count_realloc(MM_REALLOC_IN_PLACE, 0);
+            free(new_head+1);
+
+            return og_head +1;
+        }
+        else{
+            // grow in place into a free right neighbour. Growing the heap under a block at its top is left to
+            // the move below, since blocks that keep growing at the top split the span fences above them
+            if (expand_block(og_head, size+16, size+16, false) != 0){
+                count_realloc(MM_REALLOC_IN_PLACE, 0);
+                return og_head + 1;
+            }
+            else{   // move the data to a free block, or to new space at the top, then free the old block
+
+                size_t probes = 0;
+                size_t* retval = alloc_block(size, &probes);
+                if (retval == NULL){
+                    return NULL;
+                }
+                *(retval - 1) |= *og_head & HINT_MASK;  // the moved block keeps its hint group
+
+                memcpy(retval, og_head + 1, og_size-16);
+                count_realloc(MM_REALLOC_MOVED, og_size-16);
+
+                free(oldptr);
+
+                return retval;
+                
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * calloc
+ * Only clears what may hold old data: memory the heap grows into for the first time is already zero, and
+ * so are new mappings and spans whose pages were released to the OS. Fails with ENOMEM if nmemb * size overflows
+ * or is more than the heap could ever hold, before align() could wrap it around to a small size.
+ */
+void* calloc(size_t nmemb, size_t size)
+{
+    if (nmemb != 0 && size > SIZE_MAX / nmemb){
+        errno = ENOMEM;
+        return NULL;
+    }
+    size *= nmemb;
+    if (size > MAX_REQUEST_BYTES){
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    char* fresh = mm_heap_fresh();  // blocks carved out above this have never been written
+    bool zeroed = false;
+    char* ptr;
+    if (align(size) >= heap_root()->map_min){  // new mappings are zero
+        ptr = map_alloc(align(size));
+        zeroed = true;
+    }
+    else if (align(size) >= SPAN_MIN_BYTES){
+        span_t* span = span_alloc((align(size) + PAGE_BYTES - 1) >> PAGE_SHIFT, &zeroed);
+        ptr = (span != NULL) ? (char*)(span->start << PAGE_SHIFT) : NULL;
+    }
+    else{
+        ptr = malloc(size);
+    }
+
+    if (ptr != NULL && !zeroed && ptr < fresh){     // clear the block up to the fresh mark, never past its end
+        size_t clear = malloc_usable_size(ptr);
+        clear = (clear < size) ? clear : size;
+        memset(ptr, 0, (clear <= (size_t)(fresh - ptr)) ? clear : (size_t)(fresh - ptr));
+    }
+    return ptr;
+}
+
+/*
+ * Allocation hints
+ * Blocks belong to a hint group, kept in bits 48-49 of their header: unhinted, short-lived, long-lived
+ * (cold blocks go with these) and hot. Each group has its own set of free lists, so a block freed by one group
+ * is reused by that group first, and short-lived churn does not break up the free space between long-lived
+ * blocks. malloc only takes a block from another group's lists, or grows the heap, when its own have nothing
+ * that fits. Freed and split-off blocks stay in the group of the block they came from.
+ */
+
+// maps MM_HINT_* flags to a hint group. Lifetime hints take precedence over hotness.
+static int hint_group(int flags){
+    if (flags & MM_HINT_SHORT_LIVED){
+        return 1;
+    }
+    if (flags & (MM_HINT_LONG_LIVED | MM_HINT_COLD)){
+        return 2;
+    }
+    return (flags & MM_HINT_HOT) ? 3 : 0;
+}
+
+/*
+ * mm_malloc_hint
+ * malloc that places the block with others of the same expected lifetime or hotness (MM_HINT_* flags).
+ * Span-sized blocks are unaffected by hints.
+ */
+void* mm_malloc_hint(size_t size, int flags)
+{
+    heap_root_t* root = heap_root();
+    int group = (align(size) < SPAN_MIN_BYTES) ? hint_group(flags) : 0;
+
+    if (root->groups[group] == NULL){   // first block of the group: give it free lists
+        free_lists_t* lists = malloc(sizeof(free_lists_t));
+        if (lists == NULL){
+            return NULL;
+        }
+        for (int list_num = 0; list_num < NUM_CLASSES; list_num++){
+            lists->seg_list[list_num] = NULL;
+            lists->list_len[list_num] = 0;
+        }
+        root->groups[group] = lists;
+    }
+
+    root->alloc_group = group;
+    void* ptr = malloc(size);
+    root->alloc_group = 0;
+    return ptr;
+}
+
+/*
+ * Batches
+ * mm_malloc_batch carves all blocks out of one free block, or one heap extension, instead of searching the
+ * free lists n times. mm_free_batch sorts the pointers by address so that runs of adjacent blocks are merged
+ * into one block and freed, which coalesces and links each run once.
+ */
+
+// splits the allocated (or unlinked free) block at curr into n blocks of block bytes each, stored in out.
+// A remainder large enough for a free block is freed; 16 spare bytes go to the last block. Returns nothing.
+static void carve(size_t* curr, size_t block, size_t n, void** out){
+    size_t rest = get_size(curr) - n * block;
+
+    for (size_t i = 0; i < n; i++){
+        size_t b_size = (i == n - 1 && rest == 16) ? block + 16 : block;
+        *curr = set_alloc(b_size);
+        *(curr + b_size/8 - 1) = *curr;
+        out[i] = curr + 1;
+        curr += b_size/8;
+    }
+    if (rest >= 32){
+        *curr = set_alloc(rest);
+        *(curr + rest/8 - 1) = *curr;
+        free(curr + 1);
+    }
+}
+
+/*
+ * mm_malloc_batch
+ * Allocates n blocks of size bytes into out. Returns the number allocated, which is n unless memory ran out.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void** out)
+{
+    size = align(size > 0 ? size : 1);
+    size_t block = size + 16;
+    size_t done = 0;
+
+    if (n > 1 && size < SPAN_MIN_BYTES && n <= (SIZE_MASK >> 1) / block){
+        heap_root_t* root = heap_root();
+        size_t total = n * block;
+        size_t* found = NULL;
+
+        if (size <= SMALL_CLASS_MAX){
+            root->size_hist[size >> 4] += n;
+        }
+
+        // first fit for the whole batch, starting at the class of its total size
+        for (int class_num = find_class(total - 16); class_num < NUM_CLASSES && found == NULL; class_num++){
+            dll_node_t* head = root->lists.seg_list[root->order[class_num]];
+            dll_node_t* node = head;
+            size_t list_probes = 0;
+            while (node != NULL && (probe_limit == 0 || list_probes++ < probe_limit)){
+                if (get_size((size_t*)node - 1) >= total){
+                    found = (size_t*)node - 1;
+                    delete_node((size_t*)node);
+                    break;
+                }
+                node = node->next;
+                if (node == head){
+                    break;
+                }
+            }
+        }
+        if (found == NULL){
+            size_t* new = extend_heap(total - 16, false);
+            found = (new != NULL) ? new - 1 : NULL;
+        }
+        if (found != NULL){
+            carve(found, block, n, out);
+            done = n;
+        }
+    }
+
+    for (; done < n; done++){   // one at a time when batching does not apply or memory ran out
+        if ((out[done] = malloc(size)) == NULL){
+            break;
+        }
+    }
+    return done;
+}
+
+// orders pointers by address for qsort
+static int compare_ptrs(const void* a, const void* b){
+    uintptr_t x = (uintptr_t)*(void* const*)a;
+    uintptr_t y = (uintptr_t)*(void* const*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * mm_free_batch
+ * Frees the n blocks in ptrs, which is sorted by address in the process. NULL entries are skipped, and page
+ * spans and mapped blocks are freed one by one.
+ */
+void mm_free_batch(void** ptrs, size_t n)
+{
+    qsort(ptrs, n, sizeof(void*), compare_ptrs);
+
+    size_t i = 0;
+    while (i < n){
+        if (ptrs[i] == NULL || is_mapped(ptrs[i]) || span_of(ptrs[i]) != NULL){    // free sorts these out
+            free(ptrs[i++]);
+            continue;
+        }
+
+        // grow a run while the next pointer is the block right after the run
+        size_t* run = (size_t*)ptrs[i] - 1;
+        size_t run_size = get_size(run);
+        for (i++; i < n && (size_t*)ptrs[i] - 1 == run + run_size/8 && !is_mapped(ptrs[i])
+                  && span_of(ptrs[i]) == NULL; i++){
+            run_size += get_size((size_t*)ptrs[i] - 1);
+        }
+
+        *run = set_alloc(run_size) | (*run & HINT_MASK);
+        *(run + run_size/8 - 1) = *run;
+        free_block(run + 1);
+    }
+}
+
+/*
+ * Regions
+ * A region bump-allocates from chunks taken from the heap with malloc, and its objects are never freed one
+ * by one. Resetting a region rewinds it to its first chunk and keeps the standard-size chunks for the next
+ * use, so a region reused across requests stops touching the heap once it has enough chunks. Chunks made
+ * for a single oversized request are given back on reset. Destroying a region frees all its chunks.
+ */
+
+// header at the start of every region chunk, followed by its data
+typedef struct region_chunk{
+    struct region_chunk* next;
+    size_t size;    // bytes of data after the header
+} __attribute__((aligned(ALIGNMENT))) region_chunk_t;
+
+struct mm_region{
+    region_chunk_t* chunks;     // standard-size chunks, in the order they are filled
+    region_chunk_t* curr;       // chunk being bump-allocated from
+    region_chunk_t* big;        // oversized chunks, freed on reset
+    char* bump;     // next free byte of curr
+    char* end;      // end of curr's data
+};
+
+// takes a chunk of size data bytes from the heap. Returns NULL if out of memory.
+static region_chunk_t* region_chunk(size_t size){
+    region_chunk_t* chunk = malloc(sizeof(region_chunk_t) + size);
+    if (chunk != NULL){
+        chunk->next = NULL;
+        chunk->size = size;
+    }
+    return chunk;
+}
+
+/*
+ * mm_region_create
+ * Returns an empty region, or NULL if out of memory. The first chunk is made on the first allocation.
+ */
+mm_region_t* mm_region_create(void)
+{
+    mm_region_t* region = malloc(sizeof(mm_region_t));
+    if (region != NULL){
+        region->chunks = NULL;
+        region->curr = NULL;
+        region->big = NULL;
+        region->bump = NULL;
+        region->end = NULL;
+    }
+    return region;
+}
+
+/*
+ * mm_region_alloc
+ * Allocates size bytes, aligned to ALIGNMENT, that live until the region is reset or destroyed.
+ */
+void* mm_region_alloc(mm_region_t* region, size_t size)
+{
+    size = align(size > 0 ? size : 1);
+
+    if (size > REGION_CHUNK / 4){   // would waste too much of a standard chunk
+        region_chunk_t* chunk = region_chunk(size);
+        if (chunk == NULL){
+            return NULL;
+        }
+        chunk->next = region->big;
+        region->big = chunk;
+        return chunk + 1;
+    }
+
+    if (region->bump == NULL || (size_t)(region->end - region->bump) < size){
+        // move on to the next chunk: one kept from before the last reset, or a new one
+        region_chunk_t* next = (region->curr != NULL) ? region->curr->next : region->chunks;
+        if (next == NULL){
+            next = region_chunk(REGION_CHUNK);
+            if (next == NULL){
+                return NULL;
+            }
+            if (region->curr != NULL){
+                region->curr->next = next;
+            }
+            else{
+                region->chunks = next;
+            }
+        }
+        region->curr = next;
+        region->bump = (char*)(next + 1);
+        region->end = region->bump + next->size;
+    }
+
+    void* ptr = region->bump;
+    region->bump += size;
+    return ptr;
+}
+
+/*
+ * mm_region_reset
+ * Releases every object in the region at once. Standard-size chunks are kept for reuse.
+ */
+void mm_region_reset(mm_region_t* region)
+{
+    while (region->big != NULL){
+        region_chunk_t* next = region->big->next;
+        free(region->big);
+        region->big = next;
+    }
+    region->curr = NULL;
+    region->bump = NULL;
+    region->end = NULL;
+}
+
+/*
+ * mm_region_destroy
+ * Releases every object in the region and gives all its memory back to the heap.
+ */
+void mm_region_destroy(mm_region_t* region)
+{
+    if (region == NULL){
+        return;
+    }
+    mm_region_reset(region);
+    while (region->chunks != NULL){
+        region_chunk_t* next = region->chunks->next;
+        free(region->chunks);
+        region->chunks = next;
+    }
+    free(region);
+}
+
+/*
+ * Object caches
+ * A cache hands out objects of one size and alignment from slabs it takes from the heap with memalign, in
+ * the style of kmem_cache. Free objects are kept on a stack of pointers rather than linked through their own
+ * memory, so an object's constructed state survives a free: the constructor runs once per object, when it
+ * is first carved from a slab, and freed objects come back LIFO, still warm in the cache.
+ */
+
+// header at the start of every slab, followed by its objects
+typedef struct slab{
+    struct slab* next;
+} slab_t;
+
+struct mm_cache{
+    char name[32];
+    size_t obj_size;
+    size_t stride;      // obj_size rounded up to the alignment
+    size_t align;
+    size_t per_slab;    // objects in each slab
+    void (*ctor)(void*);
+    slab_t* slabs;
+    char* fresh;        // next never-used object of the newest slab
+    char* fresh_end;
+    void** stack;       // free objects, the most recently freed on top
+    size_t top;
+    mm_cache_stats_t stats;
+};
+
+// returns the offset of the first object in a slab of cache
+static size_t slab_offset(const mm_cache_t* cache){
+    return (sizeof(slab_t) + cache->align - 1) & ~(cache->align - 1);
+}
+
+// adds a slab to cache and makes room on the free stack for its objects. Returns false if out of memory.
+static bool cache_grow(mm_cache_t* cache){
+    size_t objects = cache->stats.objects + cache->per_slab;
+    void** stack = realloc(cache->stack, objects * sizeof(void*));
+    if (stack == NULL){
+        return false;
+    }
+    cache->stack = stack;
+
+    slab_t* slab = memalign(cache->align, slab_offset(cache) + cache->per_slab * cache->stride);
+    if (slab == NULL){
+        return false;
+    }
+    slab->next = cache->slabs;
+    cache->slabs = slab;
+    cache->fresh = (char*)slab + slab_offset(cache);
+    cache->fresh_end = cache->fresh + cache->per_slab * cache->stride;
+    cache->stats.slabs++;
+    cache->stats.objects = objects;
+    return true;
+}
+
+/*
+ * mm_cache_create
+ * Makes a cache of obj_size-byte objects aligned to align (a power of two, 0 for the default). ctor, if not
+ * NULL, initializes each object once. Returns NULL if the alignment is invalid or memory ran out.
+ */
+mm_cache_t* mm_cache_create(const char* name, size_t obj_size, size_t align, void (*ctor)(void*))
+{
+    align = (align > ALIGNMENT) ? align : ALIGNMENT;
+    if ((align & (align - 1)) != 0 || obj_size == 0){
+        return NULL;
+    }
+
+    mm_cache_t* cache = malloc(sizeof(mm_cache_t));
+    if (cache == NULL){
+        return NULL;
+    }
+    memset(cache, 0, sizeof(mm_cache_t));
+    strncpy(cache->name, name != NULL ? name : "", sizeof(cache->name) - 1);
+    cache->obj_size = obj_size;
+    cache->stride = (obj_size + align - 1) & ~(align - 1);
+    cache->align = align;
+    cache->per_slab = (SLAB_BYTES - slab_offset(cache)) / cache->stride;
+    cache->per_slab = (cache->per_slab > SLAB_MIN_OBJECTS) ? cache->per_slab : SLAB_MIN_OBJECTS;
+    cache->ctor = ctor;
+    cache->stats.name = cache->name;
+    cache->stats.obj_size = obj_size;
+    return cache;
+}
+
+/*
+ * mm_cache_alloc
+ * Returns a constructed object: the most recently freed one, or a new one from a slab. NULL if out of memory.
+ */
+void* mm_cache_alloc(mm_cache_t* cache)
+{
+    void* obj;
+
+    if (cache->top > 0){
+        obj = cache->stack[--cache->top];
+    }
+    else{
+        if (cache->fresh == cache->fresh_end && !cache_grow(cache)){
+            return NULL;
+        }
+        obj = cache->fresh;
+        cache->fresh += cache->stride;
+        if (cache->ctor != NULL){
+            cache->ctor(obj);
+            cache->stats.ctor_calls++;
+        }
+    }
+    cache->stats.allocs++;
+    cache->stats.in_use++;
+    return obj;
+}
+
+/*
+ * mm_cache_free
+ * Gives obj back to its cache. The object keeps its state for the next mm_cache_alloc.
+ */
+void mm_cache_free(mm_cache_t* cache, void* obj)
+{
+    if (obj == NULL){
+        return;
+    }
+    dbg_assert(cache->stats.in_use > 0);
+    cache->stack[cache->top++] = obj;   // the stack has room for every object of every slab
+    cache->stats.frees++;
+    cache->stats.in_use--;
+}
+
+/*
+ * mm_cache_stats
+ * Fills in stats for cache.
+ */
+void mm_cache_stats(const mm_cache_t* cache, mm_cache_stats_t* stats)
+{
+    *stats = cache->stats;
+}
+
+/*
+ * mm_cache_destroy
+ * Frees every slab of the cache, and the cache. Objects still in use become invalid.
+ */
+void mm_cache_destroy(mm_cache_t* cache)
+{
+    if (cache == NULL){
+        return;
+    }
+    while (cache->slabs != NULL){
+        slab_t* next = cache->slabs->next;
+        free(cache->slabs);
+        cache->slabs = next;
+    }
+    free(cache->stack);
+    free(cache);
+}
+
+/*
+ * Heaps
+ * Besides the default heap in memlib's heap area, any number of independent heaps can be made, each in a
+ * memlib segment of its own. A heap is identified by its root, and the allocator works on the heap whose
+ * root first points to, so the mm_heap_ functions switch first and the memlib segment around a call to the
+ * function they wrap. Destroying a heap unmaps its segment. Like the rest of mm.c, this is not thread-safe.
+ *
+ * A shared heap lives in a shared memory segment that other processes attach at the same address, so every
+ * pointer in it, from the free lists to the span metadata, is valid in all of them and no metadata needs
+ * translating. The mm_heap_ functions hold the segment's process-shared lock around each call. Huge blocks
+ * stay in the heap, since memlib mappings are private to a process, and blocks handed to another process
+ * can be named by their offset from the heap. A persistent heap works the same way over a file: reopening it
+ * maps the file at its old address and runs the heap checker instead of rebuilding anything.
+ */
+
+// makes heap the one the allocator works on. Returns the previous one.
+static heap_root_t* heap_switch(heap_root_t* heap){
+    heap_root_t* prev = heap_root();
+    first = heap;
+    mm_segment_select(heap != NULL ? heap->segment : NULL);
+    return prev;
+}
+
+// switches to heap for one call of the mm_heap_ functions, taking its lock if it is shared. Returns the previous heap.
+static heap_root_t* heap_enter(heap_root_t* heap){
+    mm_segment_lock(heap->segment);
+    return heap_switch(heap);
+}
+
+// switches back to prev after heap_enter(heap)
+static void heap_leave(heap_root_t* heap, heap_root_t* prev){
+    heap_switch(prev);
+    mm_segment_unlock(heap->segment);
+}
+
+/*
+ * mm_heap_create
+ * Makes an empty heap that can grow to max_size bytes. Returns NULL on error.
+ */
+mm_heap_t* mm_heap_create(size_t max_size)
+{
+    mem_segment_t* segment = mm_segment_create(max_size);
+    if (segment == NULL){
+        return NULL;
+    }
+
+    heap_root_t* prev = heap_root();
+    mm_segment_select(segment);
+    heap_root_t* heap = mm_init() ? heap_root() : NULL;
+    if (heap != NULL){
+        heap->segment = segment;
+    }
+    heap_switch(prev);
+
+    if (heap == NULL){
+        mm_segment_destroy(segment);
+    }
+    return heap;
+}
+
+/*
+ * mm_heap_destroy
+ * Releases a heap and every block in it at once.
+ */
+void mm_heap_destroy(mm_heap_t* heap)
+{
+    if (heap != NULL){
+        while (heap->mapped != NULL){   // its huge blocks are outside the segment
+            map_block_t* block = heap->mapped;
+            heap->mapped = block->next;
+            mm_munmap(block, block->len);
+        }
+        mm_segment_destroy(heap->segment);
+    }
+}
+
+void* mm_heap_malloc(mm_heap_t* heap, size_t size)
+{
+    heap_root_t* prev = heap_enter(heap);
+    void* ptr = malloc(size);
+    heap_leave(heap, prev);
+    return ptr;
+}
+
+void mm_heap_free(mm_heap_t* heap, void* ptr)
+{
+    heap_root_t* prev = heap_enter(heap);
+    free(ptr);
+    heap_leave(heap, prev);
+}
+
+void* mm_heap_realloc(mm_heap_t* heap, void* ptr, size_t size)
+{
+    heap_root_t* prev = heap_enter(heap);
+    ptr = realloc(ptr, size);
+    heap_leave(heap, prev);
+    return ptr;
+}
+
+void* mm_heap_calloc(mm_heap_t* heap, size_t nmemb, size_t size)
+{
+    heap_root_t* prev = heap_enter(heap);
+    void* ptr = calloc(nmemb, size);
+    heap_leave(heap, prev);
+    return ptr;
+}
+
+bool mm_heap_checkheap(mm_heap_t* heap, int line_number)
+{
+    heap_root_t* prev = heap_enter(heap);
+    bool ok = mm_checkheap(line_number);
+    heap_leave(heap, prev);
+    return ok;
+}
+
+/*
+ * mm_heap_create_shared
+ * Makes an empty heap in the new shared memory object name, of up to max_size bytes and mapped at addr.
+ * The heap's own pointers are absolute, so every process that attaches maps it at addr too: pick a page
+ * aligned address that stays free in all of them. Returns NULL on error, with errno set by memlib (EINVAL
+ * if addr is NULL).
+ */
+mm_heap_t* mm_heap_create_shared(const char* name, size_t max_size, void* addr)
+{
+    mem_segment_t* segment = mm_segment_create_shared(name, max_size, addr);
+    if (segment == NULL){
+        return NULL;
+    }
+
+    heap_root_t* prev = heap_root();
+    mm_segment_select(segment);
+    heap_root_t* heap = mm_init() ? heap_root() : NULL;
+    if (heap != NULL){
+        heap->segment = segment;
+        heap->map_min = SIZE_MAX;   // a mapping would only exist in this process
+    }
+    heap_switch(prev);
+
+    if (heap == NULL){
+        mm_segment_destroy(segment);
+    }
+    return heap;
+}
+
+/*
+ * mm_heap_attach
+ * Maps the shared heap another process made in the shared memory object name into this one, at the same
+ * address. Returns NULL on error. mm_heap_destroy detaches it again.
+ */
+mm_heap_t* mm_heap_attach(const char* name)
+{
+    mem_segment_t* segment = mm_segment_attach(name);
+    if (segment == NULL){
+        return NULL;
+    }
+    mem_segment_t* prev = mm_segment_select(segment);
+    heap_root_t* heap = mm_heap_lo();   // mm_init put the root at the start of the segment
+    mm_segment_select(prev);
+    return heap;
+}
+
+// tells whether every pointer in a reopened heap's root stays inside the heap, so that check_heap can
+// follow them. Heap files never have mapped blocks.
+static bool root_in_heap(heap_root_t* root){
+    for (int group = 0; group < HINT_GROUPS; group++){
+        if (root->groups[group] == NULL){
+            continue;
+        }
+        if (!in_heap(root->groups[group]) || !in_heap(root->groups[group] + 1)){
+            return false;
+        }
+        for (int list_num = 0; list_num < NUM_CLASSES; list_num++){
+            if (root->groups[group]->seg_list[list_num] != NULL && !in_heap(root->groups[group]->seg_list[list_num])){
+                return false;
+            }
+        }
+    }
+    for (int list_num = 0; list_num < SPAN_LISTS; list_num++){
+        if (root->free_spans[list_num] != NULL && !in_heap(root->free_spans[list_num])){
+            return false;
+        }
+    }
+    void* user_root = mm_segment_user_root(root->segment);
+    return (root->pagemap == NULL || in_heap(root->pagemap)) && (root->fence == NULL || in_heap(root->fence))
+        && (user_root == NULL || in_heap(user_root)) && root->mapped == NULL;
+}
+
+/*
+ * mm_heap_open
+ * Opens the heap file at path, or makes an empty heap of up to max_size bytes there (mapped at addr, or
+ * anywhere if NULL) if there is none. The free lists, spans and blocks of an existing file are used as they
+ * are, after checking the heap invariants, and its blocks can be found again through mm_heap_user_root.
+ * mm_heap_destroy writes the heap out and closes it. Returns NULL on error, with errno set to EINVAL for
+ * a file that does not hold a consistent heap of this build's layout.
+ */
+mm_heap_t* mm_heap_open(const char* path, size_t max_size, void* addr)
+{
+    uint64_t layout = ((uint64_t)sizeof(heap_root_t) << 16) | HEAP_FILE_VERSION;
+    bool created;
+    mem_segment_t* segment = mm_segment_open(path, max_size, addr, layout, &created);
+    if (segment == NULL){
+        return NULL;
+    }
+
+    heap_root_t* prev = heap_root();
+    mm_segment_select(segment);
+    heap_root_t* heap;
+    if (created){
+        heap = mm_init() ? heap_root() : NULL;
+        if (heap != NULL){
+            heap->segment = segment;
+            heap->map_min = SIZE_MAX;   // mappings would not be in the file
+        }
+    }
+    else{
+        first = mm_heap_lo();   // the root mm_init made when the file was created
+        heap = (root_in_heap(first) && check_heap()) ? heap_root() : NULL;
+    }
+    heap_switch(prev);
+
+    if (heap == NULL){
+        mm_segment_destroy(segment);
+        errno = EINVAL;
+    }
+    return heap;
+}
+
+// remembers ptr, usually a block holding the application's index of the heap, in the heap file's header
+void mm_heap_set_user_root(mm_heap_t* heap, void* ptr)
+{
+    mm_segment_set_user_root(heap->segment, ptr);
+}
+
+// the block last passed to mm_heap_set_user_root, NULL if none
+void* mm_heap_user_root(mm_heap_t* heap)
+{
+    return mm_segment_user_root(heap->segment);
+}
+
+// offset of ptr from the start of heap, which names a block the same way in every process
+size_t mm_heap_offset(mm_heap_t* heap, const void* ptr)
+{
+    return (const char*)ptr - (const char*)heap;
+}
+
+// the block at offset bytes from the start of heap
+void* mm_heap_pointer(mm_heap_t* heap, size_t offset)
+{
+    return (char*)heap + offset;
+}
+
+// memalign for blocks that are page spans: over-allocates by the alignment and gives the
+// misaligned leading pages and the unused trailing pages back to the page heap
+static void* span_memalign(size_t alignment, size_t size){
+    size_t npages = (size + PAGE_BYTES - 1) >> PAGE_SHIFT;
+    size_t align_pages = (alignment > PAGE_BYTES) ? alignment >> PAGE_SHIFT : 1;
+
+    span_t* span = span_alloc(npages + align_pages - 1, NULL);
+    if (span == NULL){
+        return NULL;
+    }
+
+    size_t lead = -span->start & (align_pages - 1);     // pages up to the next aligned one
+    if (lead != 0){
+        span_t* aligned_span = span_split(span, lead);
+        if (aligned_span == NULL){
+            span_free(span);
+            return NULL;
+        }
+        span_free(span);
+        span = aligned_span;
+    }
+
+    span_t* tail = span_split(span, npages);
+    if (tail != NULL){
+        span_free(tail);
+    }
+    return (void*)(span->start << PAGE_SHIFT);
+}
+
+/*
+ * memalign
+ * Allocates size bytes aligned to alignment, a power of two. The block is over-allocated by the alignment;
+ * the misaligned slack in front of the aligned payload is split off and freed, and realloc's split path
+ * gives back what is left behind the payload.
+ */
+void* memalign(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0){
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT){
+        return malloc(size);
+    }
+
+    size = align(size > 0 ? size : 1);
+    if (size + alignment + 16 >= SPAN_MIN_BYTES){   // the padded request would be a span anyway
+        return span_memalign(alignment, size);
+    }
+
+    char* ptr = malloc(size + alignment + 16);
+    if (ptr == NULL){
+        return NULL;
+    }
+
+    // the slack in front must be empty or large enough to be a free block of its own
+    char* aligned_ptr = (char*)(((uintptr_t)ptr + alignment - 1) & ~(alignment - 1));
+    if (aligned_ptr != ptr && aligned_ptr - ptr < 32){
+        aligned_ptr += alignment;
+    }
+
+    if (aligned_ptr != ptr){    // split the leading slack off and free it
+        size_t* head = (size_t*)ptr - 1;
+        size_t b_size = get_size(head);
+        size_t lead = aligned_ptr - ptr;
+
+        size_t* new_head = (size_t*)aligned_ptr - 1;
+        *new_head = set_alloc(b_size - lead);
+        *(head + b_size/8 - 1) = *new_head;
+
+        *head = set_alloc(lead);
+        *(new_head - 1) = *head;
+        free(ptr);
+    }
+
+    return realloc(aligned_ptr, size);  // shrinking in place frees the trailing remainder
+}
+
+/*
+ * posix_memalign
+ * Returns EINVAL unless alignment is a power of two multiple of sizeof(void*), ENOMEM if out of memory.
+ */
+int posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0){
+        return EINVAL;
+    }
+    void* ptr = memalign(alignment, size);
+    if (ptr == NULL){
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+/*
+ * aligned_alloc
+ */
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+/*
+ * Meshing
+ * Compaction for long-running heaps, after the Mesh allocator. Two pages whose live words do not overlap
+ * are merged: the live words of one are copied into the other at the same offsets and its virtual page is
+ * remapped onto the other's physical page, so object addresses stay the same while one physical page is
+ * given back. Every free block touching a meshed page is pinned (taken out of the free lists and marked
+ * allocated), which guarantees that later frees and allocations through either virtual page only ever
+ * reuse bytes that were live in that page. Meshing needs a file-backed heap to be able to alias pages.
+ */
+#define PAGE_WORDS (PAGE_BYTES / 8)
+#define MESH_WINDOW 64  // pages examined together when looking for pairs
+#define MESH_MAX_LIVE (PAGE_WORDS / 2)  // pages more than half live are left alone
+
+// sets bits [lo, hi) of a bitmap
+static void bits_set(uint64_t* bits, size_t lo, size_t hi){
+    for (; lo < hi && lo % 64 != 0; lo++){
+        bits[lo / 64] |= 1UL << (lo % 64);
+    }
+    for (; lo + 64 <= hi; lo += 64){
+        bits[lo / 64] = ~0UL;
+    }
+    for (; lo < hi; lo++){
+        bits[lo / 64] |= 1UL << (lo % 64);
+    }
+}
+
+// marks words [lo, hi) of the heap as live in the bitmap of the window starting at window
+static void mesh_mark(uint64_t* live, char* window, size_t* lo, size_t* hi){
+    size_t* end = (size_t*)(window + MESH_WINDOW * PAGE_BYTES);
+    lo = (lo < (size_t*)window) ? (size_t*)window : lo;
+    hi = (hi > end) ? end : hi;
+    if (lo < hi){
+        bits_set(live, lo - (size_t*)window, hi - (size_t*)window);
+    }
+}
+
+// returns the page pointer p falls into
+static char* page_of(const void* p){
+    return (char*)((uintptr_t)p & ~(PAGE_BYTES - 1));
+}
+
+// takes a free block out of the free lists for good. Returns nothing.
+static void mesh_pin(size_t* curr){
+    size_t b_size = get_size(curr);
+    delete_node(curr+1);
+    *curr = b_size | PINNED | 0x1;
+    *(curr + b_size/8 - 1) = *curr;
+}
+
+// hands back the pages that lie entirely inside free blocks (past the header and list node, before the footer)
+static void mesh_release(size_t* block, size_t* epi){
+    for (; block != epi; block += get_size(block)/8){
+        if ((*block & 0xf) == 0){
+            char* lo = page_of((char*)(block + 3) + PAGE_BYTES - 1);
+            char* hi = page_of(block + get_size(block)/8 - 1);
+            if (lo < hi){
+                mm_release(lo, hi - lo);
+            }
+        }
+    }
+}
+
+/*
+ * mm_mesh
+ * Meshes sparsely occupied pages and releases free pages. Returns the number of pages meshed away,
+ * which is 0 unless the heap is file backed.
+ */
+size_t mm_mesh(void)
+{
+    uint64_t live[MESH_WINDOW * PAGE_WORDS / 64];   // live words of each page in the window
+    bool skip[MESH_WINDOW];     // pages that must not take part in meshing
+    size_t meshed = 0;
+
+    size_t* block = (size_t*)((char*)first + sizeof(heap_root_t) + 8) + 2;   // first block after the prologue
+    size_t* epi = epilogue();
+
+    mesh_release(block, epi);
+    if (mm_remap(first, first) != 0){   // remapping a page onto itself just checks for a file-backed heap
+        return 0;
+    }
+
+    char* lo = page_of((char*)block + PAGE_BYTES - 1);
+    char* hi = page_of(epi);    // the page holding the epilogue changes when the heap grows
+
+    for (char* window = lo; window < hi; window += MESH_WINDOW * PAGE_BYTES){
+        size_t npages = (hi - window) / PAGE_BYTES;
+        npages = (npages < MESH_WINDOW) ? npages : MESH_WINDOW;
+        char* end = window + npages * PAGE_BYTES;
+
+        for (size_t i = 0; i < MESH_WINDOW * PAGE_WORDS / 64; i++){
+            live[i] = 0;
+        }
+        for (size_t i = 0; i < MESH_WINDOW; i++){
+            skip[i] = false;
+        }
+
+        // find live words: whole allocated and pinned blocks, but only the tags of free blocks
+        while (block + get_size(block)/8 <= (size_t*)window){
+            block += get_size(block)/8;
+        }
+        for (size_t* curr = block; curr < (size_t*)end; curr += get_size(curr)/8){
+            size_t b_size = get_size(curr);
+            size_t* next = curr + b_size/8;
+
+            if ((*curr & 0xf) != 0){
+                mesh_mark(live, window, curr, next);
+            }
+            else{
+                mesh_mark(live, window, curr, curr + 1);
+                mesh_mark(live, window, next - 1, next);
+            }
+            if ((*curr & FENCE) != 0 || ((*curr & 0xf) == 0 && b_size > PAGE_BYTES)){    // spans and large free blocks
+                for (char* page = page_of(curr); page < (char*)next && page < end; page += PAGE_BYTES){
+                    if (page >= window){
+                        skip[(page - window) / PAGE_BYTES] = true;
+                    }
+                }
+            }
+        }
+
+        // pair up pages greedily
+        for (size_t i = 0; i < npages; i++){
+            uint64_t* live_i = live + i * PAGE_WORDS / 64;
+            size_t count_i = 0;
+            for (size_t w = 0; w < PAGE_WORDS / 64; w++){
+                count_i += __builtin_popcountl(live_i[w]);
+            }
+            if (skip[i] || count_i > MESH_MAX_LIVE){
+                continue;
+            }
+
+            for (size_t j = i + 1; j < npages; j++){
+                uint64_t* live_j = live + j * PAGE_WORDS / 64;
+                size_t count_j = 0;
+                bool overlap = false;
+                for (size_t w = 0; w < PAGE_WORDS / 64; w++){
+                    count_j += __builtin_popcountl(live_j[w]);
+                    overlap = overlap || (live_i[w] & live_j[w]) != 0;
+                }
+                if (skip[j] || count_j > MESH_MAX_LIVE || overlap){
+                    continue;
+                }
+
+                char* page_i = window + i * PAGE_BYTES;
+                char* page_j = window + j * PAGE_BYTES;
+                uint64_t copy[PAGE_WORDS / 64];     // page j's live words, before pinning adds to them
+                for (size_t w = 0; w < PAGE_WORDS / 64; w++){
+                    copy[w] = live_j[w];
+                }
+
+                // pin the free blocks touching either page; their link words stop being live
+                for (size_t* curr = block; curr < (size_t*)end; curr += get_size(curr)/8){
+                    char* b_end = (char*)(curr + get_size(curr)/8);
+                    bool touches_i = (char*)curr < page_i + PAGE_BYTES && b_end > page_i;
+                    bool touches_j = (char*)curr < page_j + PAGE_BYTES && b_end > page_j;
+                    if ((*curr & 0xf) == 0 && (touches_i || touches_j)){
+                        mesh_pin(curr);
+                        mesh_mark(live, window, curr, (size_t*)b_end);  // pinned blocks count as live from now on
+                    }
+                }
+
+                // copy page j's live words into page i, then alias page j onto page i
+                for (size_t w = 0; w < PAGE_WORDS; w++){
+                    if ((copy[w / 64] >> (w % 64)) & 1){
+                        ((size_t*)page_i)[w] = ((size_t*)page_j)[w];
+                    }
+                }
+                if (mm_remap(page_j, page_i) != 0){
+                    return meshed;
+                }
+                skip[i] = true;
+                skip[j] = true;
+                meshed++;
+                break;
+            }
+        }
+    }
+    return meshed;
 }
 
 /*
@@ -610,20 +2740,14 @@ static bool aligned(const void* p)
     return align(ip) == ip;
 }
 
-/*
- * mm_checkheap
- * You call the function via mm_checkheap(__LINE__)
- * The line number can be used to print the line number of the calling
- * function where there was an invalid heap.
- */
-bool mm_checkheap(int line_number)
+// checks the invariants below on the heap in use. mm_checkheap runs it in debug builds only, while reopening
+// a persistent heap runs it in any build.
+static bool check_heap(void)
 {
-#ifdef DEBUG
-    // Write code to check heap invariants here
-    // IMPLEMENT THIS
-    
-    size_t* curr = first + 8;
+    dll_node_t** seg_list;
+    size_t* curr = first + sizeof(heap_root_t) + 8;
     size_t* next = curr + 2;
+    size_t free_bytes = 0;
     
     // Iterate through the entire heap: Invariants #1 - #4
     while (*next != 0x1){
@@ -636,14 +2760,25 @@ bool mm_checkheap(int line_number)
         size_t* foot = curr + (b_size_curr-8)/8;
 
         if (alloc_curr == 0x0){
+            free_bytes += b_size_curr;
 
             // INVARIANT #1: Is Header equal to header? NOTE: only check when free considering footer optimization
-            if (*curr != *foot){
+            if (get_size(curr) != *foot){
                 return false;
             }
-            
 
+            // INVARIANT #10: Does the list index cached in the header match the block size?
             int listnum = find_list(b_size_curr-16);
+            if ((int)((*curr >> CLASS_SHIFT) & LIST_BITS) != listnum){
+                return false;
+            }
+
+            // INVARIANT #11: Does the block's hint group have its free lists?
+            if (heap_root()->groups[(*curr & HINT_MASK) >> HINT_SHIFT] == NULL){
+                return false;
+            }
+            seg_list = heap_root()->groups[(*curr & HINT_MASK) >> HINT_SHIFT]->seg_list;
+
             dll_node_t* free_node = (dll_node_t*)(curr +1);
             if (seg_list[listnum] == 0x0){
                 return false;
@@ -665,7 +2800,7 @@ bool mm_checkheap(int line_number)
         }
 
         // INVARIANT #3: Is header garbage? ie. there is/are overlapping data/blocks
-        if (alloc_curr != 0x0 && alloc_curr != 0x1 && alloc_curr != 0x10 && alloc_curr != 0x11){
+        if (alloc_curr != 0x0 && alloc_curr != 0x1 && alloc_curr != (FENCE | 0x1) && alloc_curr != (PINNED | 0x1)){
             return false;
         }
 
@@ -683,40 +2818,264 @@ bool mm_checkheap(int line_number)
         next = curr + b_size_next/8;
 
     }
-    int list_num = 0;
+    if ((*curr & 0xf) == 0){    // the last block before the epilogue
+        free_bytes += get_size(curr);
+    }
 
-    // iterate through the segregated lists. Invariantes #6 - #7
-    while (list_num < 15){
-        if (seg_list[list_num] != NULL){
-            curr = (size_t*)(seg_list[list_num]) - 1;
+    // INVARIANT #13: Does the root's count of free bytes match the free blocks?
+    if (free_bytes != heap_root()->free_bytes){
+        return false;
+    }
+    int list_num;
+
+    // iterate through the segregated lists of every hint group. Invariantes #6 - #7
+    for (int group = 0; group < HINT_GROUPS; group++){
+        if (heap_root()->groups[group] == NULL){
+            continue;
+        }
+        seg_list = heap_root()->groups[group]->seg_list;
+        list_num = 0;
+        while (list_num < NUM_CLASSES){
+            if (seg_list[list_num] != NULL){
+                curr = (size_t*)(seg_list[list_num]) - 1;
             
-            if (seg_list[list_num]->next != seg_list[list_num]){
-                struct dll_node* curr_node = seg_list[list_num]->next;
-                curr = (size_t*)curr_node - 1;
+                if (seg_list[list_num]->next != seg_list[list_num]){
+                    struct dll_node* curr_node = seg_list[list_num]->next;
+                    curr = (size_t*)curr_node - 1;
 
-                while (curr_node != seg_list[list_num]){
+                    while (curr_node != seg_list[list_num]){
 
-                    size_t alloc = *curr & 0x000000000000000f;
+                        size_t alloc = *curr & 0x000000000000000f;
 
-                    // INVARIANT #6: Do all pointers in the segregated free lists point to an actual free block?
-                    if (alloc != 0){
-                        return false;
-                    }
+                        // INVARIANT #6: Do all pointers in the segregated free lists point to an actual free block?
+                        if (alloc != 0){
+                            return false;
+                        }
 
-                    // INVARIANT #7: Do next and prev pointers point to each other?
-                    if (curr_node != curr_node->next->prev){
-                        return false;
-                    }
+                        // INVARIANT #7: Do next and prev pointers point to each other?
+                        if (curr_node != curr_node->next->prev){
+                            return false;
+                        }
 
-                    curr_node = curr_node->next;
-                    curr = (size_t*)curr_node - 1;
-                    }
+                        curr_node = curr_node->next;
+                        curr = (size_t*)curr_node - 1;
+                        }
+                }
             }
+            list_num = list_num + 1;
         }
-        list_num = list_num + 1;
     }
-    
-    
-#endif // DEBUG
+
+    // iterate through the free span lists. Invariants #8 - #9
+    for (list_num = 0; list_num < SPAN_LISTS; list_num++){
+        for (span_t* span = heap_root()->free_spans[list_num]; span != NULL; span = span->next){
+
+            // INVARIANT #8: Does the pagemap map both ends of every free span back to it?
+            if (!span->free || span_lookup(span->start) != span
+                || span_lookup(span->start + span->npages - 1) != span){
+                return false;
+            }
+
+            // INVARIANT #9: Are there two adjacent free spans that have not been coalesced?
+            span_t* right = span_lookup(span->start + span->npages);
+            if (right != NULL && right->free){
+                return false;
+            }
+        }
+    }
+
+    // iterate through the mapped blocks. Invariant #12
+    for (map_block_t* block = heap_root()->mapped; block != NULL; block = block->next){
+
+        // INVARIANT #12: Is every mapped block outside the heap, whole pages long and linked both ways?
+        if (!is_mapped(block + 1) || ((uintptr_t)block & (PAGE_BYTES - 1)) != 0
+            || (block->len & (PAGE_BYTES - 1)) != 0 || block->len < sizeof(map_block_t) + MAP_MIN_BYTES
+            || (block->next != NULL && block->next->prev != block)){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * mm_checkheap
+ * You call the function via mm_checkheap(__LINE__)
+ * The line number can be used to print the line number of the calling
+ * function where there was an invalid heap.
+ */
+bool mm_checkheap(int line_number)
+{
+#ifdef DEBUG
+    return check_heap();
+#else
     return true;
+#endif // DEBUG
+}
+
+#ifndef DRIVER
+/*
+ * Interposition
+ * Built without DRIVER (make libmm.so), mm.c replaces the C library's allocator: LD_PRELOAD=./libmm.so
+ * makes every malloc, free and relative in a program land here. The entry points below set the heap up
+ * on the first call, and serialize all calls with one lock, since the allocator itself is not thread-safe.
+ * Only these are exported from the library. valloc, pvalloc and reallocarray are included because the C
+ * library's versions would allocate from its own heap and hand the blocks to our free.
+ */
+#undef malloc
+#undef free
+#undef realloc
+#undef calloc
+#undef memalign
+#undef posix_memalign
+#undef aligned_alloc
+#undef malloc_usable_size
+#undef free_sized
+#undef free_aligned_sized
+
+#define EXPORT __attribute__((visibility("default")))
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void lock_heap(void){
+    pthread_mutex_lock(&heap_lock);
+}
+
+static void unlock_heap(void){
+    pthread_mutex_unlock(&heap_lock);
+}
+
+// makes the heap on the first call; a forked child inherits it with the lock held by the forking thread
+static bool heap_ready(void){
+    if (first != NULL){
+        return true;
+    }
+    mem_init();
+    pthread_atfork(lock_heap, unlock_heap, unlock_heap);
+    return mm_init();
+}
+
+EXPORT void* malloc(size_t size)
+{
+    lock_heap();
+    void* ptr = heap_ready() ? mm_malloc(size) : NULL;
+    unlock_heap();
+    if (ptr == NULL){
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+EXPORT void free(void* ptr)
+{
+    if (ptr == NULL){
+        return;
+    }
+    lock_heap();
+    if (first != NULL){     // anything freed before the first malloc is not ours
+        mm_free(ptr);
+    }
+    unlock_heap();
+}
+
+EXPORT void* realloc(void* ptr, size_t size)
+{
+    lock_heap();
+    void* new_ptr = heap_ready() ? mm_realloc(ptr, size) : NULL;
+    unlock_heap();
+    if (new_ptr == NULL && size != 0){
+        errno = ENOMEM;
+    }
+    return new_ptr;
+}
+
+EXPORT void* calloc(size_t nmemb, size_t size)
+{
+    lock_heap();
+    void* ptr = heap_ready() ? mm_calloc(nmemb, size) : NULL;
+    unlock_heap();
+    if (ptr == NULL){
+        errno = ENOMEM;
+    }
+    return ptr;
+}
+
+EXPORT void* reallocarray(void* ptr, size_t nmemb, size_t size)
+{
+    size_t bytes;
+    if (__builtin_mul_overflow(nmemb, size, &bytes)){
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, bytes);
+}
+
+EXPORT void* memalign(size_t alignment, size_t size)
+{
+    lock_heap();
+    void* ptr = heap_ready() ? mm_memalign(alignment, size) : NULL;
+    unlock_heap();
+    if (ptr == NULL){
+        errno = (alignment == 0 || (alignment & (alignment - 1)) != 0) ? EINVAL : ENOMEM;
+    }
+    return ptr;
+}
+
+EXPORT int posix_memalign(void** memptr, size_t alignment, size_t size)
+{
+    lock_heap();
+    int err = heap_ready() ? mm_posix_memalign(memptr, alignment, size) : ENOMEM;
+    unlock_heap();
+    return err;
+}
+
+EXPORT void* aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+EXPORT void* valloc(size_t size)
+{
+    return memalign(mm_pagesize(), size);
+}
+
+EXPORT void* pvalloc(size_t size)
+{
+    size_t page = mm_pagesize();
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+EXPORT size_t malloc_usable_size(void* ptr)
+{
+    if (ptr == NULL){
+        return 0;
+    }
+    lock_heap();
+    size_t size = (first != NULL) ? mm_usable_size(ptr) : 0;
+    unlock_heap();
+    return size;
+}
+
+EXPORT void free_sized(void* ptr, size_t size)
+{
+    if (ptr == NULL){
+        return;
+    }
+    lock_heap();
+    if (first != NULL){
+        mm_free_sized(ptr, size);
+    }
+    unlock_heap();
+}
+
+EXPORT void free_aligned_sized(void* ptr, size_t alignment, size_t size)
+{
+    if (ptr == NULL){
+        return;
+    }
+    lock_heap();
+    if (first != NULL){
+        mm_free_aligned_sized(ptr, alignment, size);
+    }
+    unlock_heap();
 }
+#endif // !DRIVER
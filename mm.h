@@ -1,25 +1,139 @@
 #include <stdio.h>
 #include <stdbool.h>
 
-#ifdef DRIVER
-
-/* declare functions for driver tests */
+/* declare functions for driver tests; libmm.so wraps them in the standard names */
 extern void* mm_malloc (size_t size);
 extern void mm_free (void* ptr);
 extern void* mm_realloc(void* ptr, size_t size);
 extern void* mm_calloc (size_t nmemb, size_t size);
+extern void* mm_memalign(size_t alignment, size_t size);
+extern int mm_posix_memalign(void** memptr, size_t alignment, size_t size);
+extern void* mm_aligned_alloc(size_t alignment, size_t size);
+extern size_t mm_usable_size(void* ptr);
+extern void mm_free_sized(void* ptr, size_t size);
+extern void mm_free_aligned_sized(void* ptr, size_t alignment, size_t size);
 
-#else
+#ifndef DRIVER
 
 /* declare functions for interpositioning */
 extern void* malloc (size_t size);
 extern void free (void* ptr);
 extern void* realloc(void* ptr, size_t size);
 extern void* calloc (size_t nmemb, size_t size);
+extern void* memalign(size_t alignment, size_t size);
+extern int posix_memalign(void** memptr, size_t alignment, size_t size);
+extern void* aligned_alloc(size_t alignment, size_t size);
+extern size_t malloc_usable_size(void* ptr);
+extern void free_sized(void* ptr, size_t size);
+extern void free_aligned_sized(void* ptr, size_t alignment, size_t size);
+extern void* valloc(size_t size);
+extern void* pvalloc(size_t size);
+extern void* reallocarray(void* ptr, size_t nmemb, size_t size);
 
 #endif
 
 extern bool mm_init(void);
 
+/* Meshes sparsely occupied pages to cut physical memory. Returns the number of pages given back. */
+extern size_t mm_mesh(void);
+
+/* Placement hints for mm_malloc_hint, or'd together */
+enum { MM_HINT_SHORT_LIVED = 0x1, MM_HINT_LONG_LIVED = 0x2, MM_HINT_HOT = 0x4, MM_HINT_COLD = 0x8 };
+
+/* malloc that keeps blocks with the same hints together */
+extern void* mm_malloc_hint(size_t size, int flags);
+
+/* Allocates n blocks of size bytes into out, returning how many were allocated; frees n blocks (sorts ptrs) */
+extern size_t mm_malloc_batch(size_t size, size_t n, void** out);
+extern void mm_free_batch(void** ptrs, size_t n);
+
+/* Regions: objects bump-allocated from heap chunks and released all at once by reset or destroy */
+typedef struct mm_region mm_region_t;
+extern mm_region_t* mm_region_create(void);
+extern void* mm_region_alloc(mm_region_t* region, size_t size);
+extern void mm_region_reset(mm_region_t* region);
+extern void mm_region_destroy(mm_region_t* region);
+
+/* Object caches: fixed-size objects from slabs, constructed once and kept constructed across free */
+typedef struct mm_cache mm_cache_t;
+typedef struct mm_cache_stats {
+    const char* name;
+    size_t obj_size;
+    size_t slabs;       /* slabs taken from the heap */
+    size_t objects;     /* objects the slabs hold */
+    size_t in_use;
+    size_t allocs;
+    size_t frees;
+    size_t ctor_calls;
+} mm_cache_stats_t;
+extern mm_cache_t* mm_cache_create(const char* name, size_t obj_size, size_t align, void (*ctor)(void*));
+extern void* mm_cache_alloc(mm_cache_t* cache);
+extern void mm_cache_free(mm_cache_t* cache, void* obj);
+extern void mm_cache_stats(const mm_cache_t* cache, mm_cache_stats_t* stats);
+extern void mm_cache_destroy(mm_cache_t* cache);
+
+/* Independent heaps, each in a memlib segment of its own; the functions above work on the default heap */
+typedef struct heap_root mm_heap_t;
+extern mm_heap_t* mm_heap_create(size_t max_size);
+extern void mm_heap_destroy(mm_heap_t* heap);
+extern void* mm_heap_malloc(mm_heap_t* heap, size_t size);
+extern void mm_heap_free(mm_heap_t* heap, void* ptr);
+extern void* mm_heap_realloc(mm_heap_t* heap, void* ptr, size_t size);
+extern void* mm_heap_calloc(mm_heap_t* heap, size_t nmemb, size_t size);
+extern bool mm_heap_checkheap(mm_heap_t* heap, int line_number);
+
+/* Shared heaps: made in a POSIX shared memory object, attached by other processes at the same address and
+   locked around each mm_heap_ call; blocks can be handed over as offsets from the heap. addr is required
+   and must be free in every process that attaches, or mm_heap_attach fails with EEXIST */
+extern mm_heap_t* mm_heap_create_shared(const char* name, size_t max_size, void* addr);
+extern mm_heap_t* mm_heap_attach(const char* name);
+extern size_t mm_heap_offset(mm_heap_t* heap, const void* ptr);
+extern void* mm_heap_pointer(mm_heap_t* heap, size_t offset);
+
+/* Persistent heaps: kept in a file, reopened at the same address with their contents and free lists intact */
+extern mm_heap_t* mm_heap_open(const char* path, size_t max_size, void* addr);
+extern void mm_heap_set_user_root(mm_heap_t* heap, void* ptr);
+extern void* mm_heap_user_root(mm_heap_t* heap);
+
+/* Grows a block in place to between min_size and max_size bytes; returns its usable size afterwards */
+extern size_t mm_try_expand(void* ptr, size_t min_size, size_t max_size);
+
+/* Bounds the free blocks one malloc inspects in all (0: unbounded), and reports the probe counts seen */
+extern void mm_set_probe_limit(size_t limit);
+extern void mm_probe_stats(size_t* max, size_t* p99);
+
+/* Cases counted by mm_stats: where free blocks are split off, which neighbours free coalesces with, and
+   how realloc kept the data */
+enum { MM_SPLIT_MALLOC, MM_SPLIT_REALLOC, MM_SPLIT_EXPAND, MM_SPLIT_GROW, MM_SPLIT_CASES };
+enum { MM_COALESCE_NONE, MM_COALESCE_LEFT, MM_COALESCE_RIGHT, MM_COALESCE_BOTH, MM_COALESCE_CASES };
+enum { MM_REALLOC_IN_PLACE, MM_REALLOC_REMAPPED, MM_REALLOC_MOVED, MM_REALLOC_CASES };
+
+#ifdef MM_STATS
+#define MM_STATS_CLASSES 256     /* as many classes as free block headers can name */
+#define MM_STATS_PROBE_BUCKETS 10
+
+/* Allocator statistics of the heap in use, only in builds with MM_STATS (make stats) */
+typedef struct mm_stats {
+    size_t heap_bytes;      /* heap size plus mapped bytes */
+    size_t live_bytes;      /* usable bytes of allocated blocks, spans and mappings */
+    size_t free_bytes;      /* bytes in free blocks and free spans */
+    size_t classes;         /* size classes in use */
+    size_t free_blocks[MM_STATS_CLASSES];       /* free blocks per size class, smallest class first */
+    size_t free_class_bytes[MM_STATS_CLASSES];  /* their bytes */
+    size_t free_spans;
+    size_t mallocs;
+    size_t probes[MM_STATS_PROBE_BUCKETS];  /* mallocs by free blocks inspected: 0, 1, 2-3, 4-7, ..., 256 or more */
+    size_t probe_max;
+    size_t sbrk_calls;
+    size_t sbrk_bytes;
+    size_t splits[MM_SPLIT_CASES];
+    size_t coalesces[MM_COALESCE_CASES];
+    size_t reallocs[MM_REALLOC_CASES];
+    size_t realloc_copied;  /* bytes copied by reallocs that moved the block */
+} mm_stats_t;
+
+extern void mm_stats(mm_stats_t* stats);
+#endif
+
 /* This is for debugging.  Returns false if error encountered */
 extern bool mm_checkheap(int line_number);
@@ -0,0 +1,559 @@
+/*
+ * mmtest.c - checks for the parts of mm.c and memlib.c that the traces
+ * do not reach
+ *
+ * Each test starts on a fresh heap and runs with the heap checker on
+ * (the program is built with DEBUG). A failed check prints the test
+ * and the condition; the exit status is the number of failed tests.
+ *
+ * Usage: mmtest [test ...]    (all tests without arguments)
+ *        mmtest --attach name offset    (the other process of the shared test)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "config.h"
+
+/* Name of the running test and whether one of its checks failed */
+static const char *test_name;
+static bool test_failed;
+
+/*
+ * expect - records a failed check of the running test
+ */
+static void expect(bool ok, const char *what, int line)
+{
+    if (!ok) {
+        printf("  %s: line %d: %s\n", test_name, line, what);
+        test_failed = true;
+    }
+}
+
+/*
+ * fresh_heap - starts a test on an empty default heap
+ */
+static void fresh_heap(void)
+{
+    mem_reset_brk();
+    if (!mm_init()) {
+        printf("mm_init failed\n");
+        exit(1);
+    }
+}
+
+/*
+ * test_span_release - freed page spans hand their pages back to the OS
+ *     every time, not only the first time the pages are freed
+ */
+static void test_span_release(void)
+{
+    enum { BLOCKS = 8, BLOCK_BYTES = 600 * 1024, ROUNDS = 3 };
+    void *blocks[BLOCKS];
+    size_t first_pages = 0;     /* physical pages after the first round */
+    int round, i;
+
+    fresh_heap();
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < BLOCKS; i++) {
+            blocks[i] = mm_malloc(BLOCK_BYTES);
+            expect(blocks[i] != NULL, "mm_malloc failed", __LINE__);
+            memset(blocks[i], round + 1, BLOCK_BYTES);
+        }
+        size_t used_pages = mem_phys_pages();
+        for (i = 0; i < BLOCKS; i++)
+            mm_free(blocks[i]);
+        expect(mm_checkheap(__LINE__), "heap check failed", __LINE__);
+
+        size_t pages = mem_phys_pages();
+        expect(pages < used_pages / 2, "freed spans kept their pages", __LINE__);
+        if (round == 0)
+            first_pages = pages;
+        expect(pages <= first_pages, "pages freed again were not released",
+               __LINE__);
+    }
+}
+
+/*
+ * test_try_expand - mm_try_expand grows blocks in place, towards
+ *     max_size even when they already hold min_size, and never moves them
+ */
+static void test_try_expand(void)
+{
+    char *a, *b, *c, *span;
+    size_t usable;
+    int i;
+
+    fresh_heap();
+    a = mm_malloc(100);
+    b = mm_malloc(200);
+    c = mm_malloc(50);
+    memset(a, 'x', 100);
+
+    usable = mm_try_expand(a, 150, 300);
+    expect(usable < 150, "grew into an allocated neighbour", __LINE__);
+
+    mm_free(b);
+    usable = mm_try_expand(a, 50, 250);
+    expect(usable >= 250, "did not grow towards max_size", __LINE__);
+    for (i = 0; i < 100; i++)
+        expect(a[i] == 'x', "payload changed", __LINE__);
+    expect(mm_usable_size(a) == usable, "usable size disagrees", __LINE__);
+
+    usable = mm_try_expand(c, 5000, 9000);      /* at the top of the heap */
+    expect(usable >= 9000, "did not grow the heap under the top block",
+           __LINE__);
+
+    span = mm_malloc(100000);  /* leaves free pages after the span below */
+    mm_free(span);
+    span = mm_malloc(40000);
+    usable = mm_try_expand(span, 40000, 60000);
+    expect(usable >= 60000, "span did not grow towards max_size", __LINE__);
+    expect(mm_checkheap(__LINE__), "heap check failed", __LINE__);
+
+    mm_free(a);
+    mm_free(c);
+    mm_free(span);
+    expect(mm_checkheap(__LINE__), "heap check failed", __LINE__);
+}
+
+/*
+ * test_batch - one mm_free_batch call frees adjacent and scattered heap
+ *     blocks together with page spans, mapped blocks and NULL entries
+ */
+static void test_batch(void)
+{
+    enum { SMALL = 16, SMALL_BYTES = 64 };
+    void *ptrs[SMALL + 8];
+    size_t n, got;
+
+    fresh_heap();
+    got = mm_malloc_batch(SMALL_BYTES, SMALL, ptrs);   /* adjacent blocks */
+    expect(got == SMALL, "mm_malloc_batch came up short", __LINE__);
+    n = got;
+    ptrs[n++] = mm_malloc(SMALL_BYTES);
+    ptrs[n++] = mm_malloc(100000);      /* a page span */
+    ptrs[n++] = mm_malloc(4 << 20);     /* a mapping of its own */
+    ptrs[n++] = NULL;
+    ptrs[n++] = mm_malloc(SMALL_BYTES);
+    ptrs[n++] = mm_malloc(8 << 20);
+    for (size_t i = 0; i < n; i++)
+        if (ptrs[i] != NULL)
+            memset(ptrs[i], 0x5a, SMALL_BYTES);
+
+    mm_free_batch(ptrs, n);
+    expect(mm_checkheap(__LINE__), "heap check failed", __LINE__);
+
+    void *again = mm_malloc(SMALL * (SMALL_BYTES + 16));    /* the merged run */
+    expect(again != NULL, "mm_malloc failed after the batch", __LINE__);
+    mm_free(again);
+    expect(mm_checkheap(__LINE__), "heap check failed", __LINE__);
+}
+
+/*
+ * test_limits - requests too large for any heap fail with ENOMEM instead
+ *     of wrapping around to a small block
+ */
+static void test_limits(void)
+{
+    fresh_heap();
+    char *live = mm_malloc(64);
+    memset(live, 0x5a, 64);
+
+    errno = 0;
+    expect(mm_calloc(1, SIZE_MAX - 8) == NULL && errno == ENOMEM,
+           "calloc near SIZE_MAX succeeded", __LINE__);
+    errno = 0;
+    expect(mm_calloc(SIZE_MAX / 2, 3) == NULL && errno == ENOMEM,
+           "calloc with an overflowing product succeeded", __LINE__);
+    expect(live[63] == 0x5a, "calloc cleared a live block", __LINE__);
+
+    errno = 0;
+    expect(mm_malloc(SIZE_MAX - 100) == NULL && errno == ENOMEM,
+           "malloc of a block too large to map succeeded", __LINE__);
+    errno = 0;
+    expect(mm_mmap(SIZE_MAX - 10) == NULL && errno == ENOMEM,
+           "mm_mmap rounded a huge length down", __LINE__);
+    errno = 0;
+    expect(mm_malloc(SIZE_MAX) == NULL && errno == ENOMEM,
+           "malloc(SIZE_MAX) succeeded", __LINE__);
+    errno = 0;
+    expect(mm_realloc(live, SIZE_MAX - 4) == NULL && errno == ENOMEM,
+           "realloc to a wrapped size succeeded", __LINE__);
+    expect(live[63] == 0x5a, "failed realloc changed the block", __LINE__);
+    char *mapped = mm_malloc(4 << 20);
+    errno = 0;
+    expect(mm_realloc(mapped, SIZE_MAX - 100) == NULL && errno == ENOMEM,
+           "mapped block grew to a wrapped size", __LINE__);
+    mm_free(mapped);
+
+    mm_free(live);
+    expect(mm_checkheap(__LINE__), "heap check failed", __LINE__);
+}
+
+/*
+ * test_region - region objects are aligned and disjoint, and a reset
+ *     region reuses its chunks instead of taking more of the heap
+ */
+static void test_region(void)
+{
+    enum { OBJECTS = 2000, BIG_BYTES = 10000 };
+    static char *objs[OBJECTS];
+    size_t heap_bytes = 0;
+    int round, i;
+
+    fresh_heap();
+    mm_region_t *region = mm_region_create();
+    expect(region != NULL, "mm_region_create failed", __LINE__);
+    for (round = 0; round < 3; round++) {
+        for (i = 0; i < OBJECTS; i++) {
+            size_t size = 1 + (size_t)i % 100;
+            objs[i] = mm_region_alloc(region, size);
+            expect(objs[i] != NULL && (uintptr_t)objs[i] % ALIGNMENT == 0,
+                   "object missing or misaligned", __LINE__);
+            memset(objs[i], i & 0xff, size);
+        }
+        char *big = mm_region_alloc(region, BIG_BYTES);
+        memset(big, 0xee, BIG_BYTES);
+        for (i = 0; i < OBJECTS; i++)
+            expect(objs[i][0] == (char)(i & 0xff), "objects overlap", __LINE__);
+        expect(mm_checkheap(__LINE__), "heap check failed", __LINE__);
+
+        if (round == 0)
+            heap_bytes = mm_heapsize();
+        expect(mm_heapsize() == heap_bytes, "reset region grew the heap",
+               __LINE__);
+        mm_region_reset(region);
+    }
+    mm_region_destroy(region);
+    expect(mm_checkheap(__LINE__), "heap check failed", __LINE__);
+}
+
+/* An object of the cache test, and its constructor */
+typedef struct {
+    uint32_t magic;     /* set by the constructor, kept across frees */
+    uint32_t id;
+    char data[32];
+} cache_obj_t;
+
+#define CACHE_MAGIC 0xcafe
+
+static size_t ctor_calls;
+
+static void cache_obj_ctor(void *obj)
+{
+    ((cache_obj_t *)obj)->magic = CACHE_MAGIC;
+    ctor_calls++;
+}
+
+/*
+ * test_cache - cache objects are aligned, constructed once, and come back
+ *     constructed and most recently freed first
+ */
+static void test_cache(void)
+{
+    enum { OBJECTS = 1000, ALIGN = 64 };
+    static cache_obj_t *objs[OBJECTS];
+    mm_cache_stats_t stats;
+    int round, i;
+
+    fresh_heap();
+    ctor_calls = 0;
+    expect(mm_cache_create("bad", sizeof(cache_obj_t), 48, NULL) == NULL,
+           "made a cache with an alignment that is not a power of two", __LINE__);
+
+    mm_cache_t *cache = mm_cache_create("test", sizeof(cache_obj_t), ALIGN,
+                                        cache_obj_ctor);
+    expect(cache != NULL, "mm_cache_create failed", __LINE__);
+    for (round = 0; round < 2; round++) {
+        for (i = 0; i < OBJECTS; i++) {
+            objs[i] = mm_cache_alloc(cache);
+            expect(objs[i] != NULL && (uintptr_t)objs[i] % ALIGN == 0,
+                   "object missing or misaligned", __LINE__);
+            expect(objs[i]->magic == CACHE_MAGIC, "object not constructed",
+                   __LINE__);
+            objs[i]->id = i;
+        }
+        for (i = 0; i < OBJECTS; i++)
+            expect(objs[i]->id == (uint32_t)i, "objects overlap", __LINE__);
+        expect(mm_checkheap(__LINE__), "heap check failed", __LINE__);
+
+        mm_cache_stats(cache, &stats);
+        expect(ctor_calls == OBJECTS && stats.ctor_calls == OBJECTS,
+               "constructor ran again", __LINE__);
+        expect(stats.in_use == OBJECTS && stats.objects >= OBJECTS,
+               "stats disagree", __LINE__);
+        for (i = 0; i < OBJECTS; i++)
+            mm_cache_free(cache, objs[i]);
+    }
+    expect(mm_cache_alloc(cache) == objs[OBJECTS - 1],
+           "not the most recently freed object", __LINE__);
+
+    mm_cache_stats(cache, &stats);
+    expect(stats.allocs == 2 * OBJECTS + 1 && stats.frees == 2 * OBJECTS
+           && stats.in_use == 1, "stats disagree", __LINE__);
+    mm_cache_destroy(cache);
+    expect(mm_checkheap(__LINE__), "heap check failed", __LINE__);
+}
+
+/*
+ * in_heap_of - whether ptr lies in the heap of up to max_size bytes
+ *     starting at heap
+ */
+static bool in_heap_of(const mm_heap_t *heap, size_t max_size, const void *ptr)
+{
+    return (const char *)ptr > (const char *)heap
+        && (const char *)ptr < (const char *)heap + max_size;
+}
+
+/*
+ * test_heaps - blocks from mm_heap_* stay in their own heap, the default
+ *     heap is left alone, and destroying one heap does not touch the others
+ */
+static void test_heaps(void)
+{
+    enum { BLOCKS = 500, HEAP_BYTES = 64 << 20 };
+    static char *blocks[2][BLOCKS];
+    mm_heap_t *heaps[2];
+    int h, i;
+
+    fresh_heap();
+    char *own = mm_malloc(100);
+    size_t default_bytes = mm_heapsize();
+    for (h = 0; h < 2; h++) {
+        heaps[h] = mm_heap_create(HEAP_BYTES);
+        expect(heaps[h] != NULL, "mm_heap_create failed", __LINE__);
+        if (heaps[h] == NULL)
+            return;
+    }
+
+    for (i = 0; i < BLOCKS; i++)
+        for (h = 0; h < 2; h++) {
+            size_t size = 1 + (size_t)(i * 37 + h) % 3000;
+            blocks[h][i] = mm_heap_malloc(heaps[h], size);
+            expect(in_heap_of(heaps[h], HEAP_BYTES, blocks[h][i]),
+                   "block outside its heap", __LINE__);
+            memset(blocks[h][i], h + 1, size);
+        }
+    char *big = mm_heap_malloc(heaps[0], 100000);   /* a page span */
+    char *huge = mm_heap_malloc(heaps[0], 4 << 20); /* a mapping of its own */
+    expect(big != NULL && huge != NULL, "large blocks failed", __LINE__);
+    expect(mm_heapsize() == default_bytes, "the default heap grew", __LINE__);
+
+    for (i = 0; i < BLOCKS; i += 2) {
+        char *moved = mm_heap_realloc(heaps[1], blocks[1][i], 5000);
+        expect(in_heap_of(heaps[1], HEAP_BYTES, moved) && moved[0] == 2,
+               "realloc left its heap or lost the data", __LINE__);
+        blocks[1][i] = moved;
+    }
+    char *zeroed = mm_heap_calloc(heaps[1], 100, 10);
+    for (i = 0; i < 1000; i++)
+        expect(zeroed[i] == 0, "calloc block not zero", __LINE__);
+    mm_heap_free(heaps[1], zeroed);
+    for (i = 1; i < BLOCKS; i += 2)
+        mm_heap_free(heaps[1], blocks[1][i]);
+    for (h = 0; h < 2; h++)
+        expect(mm_heap_checkheap(heaps[h], __LINE__), "heap check failed",
+               __LINE__);
+
+    mm_heap_destroy(heaps[0]);
+    for (i = 0; i < BLOCKS; i += 2)
+        expect(blocks[1][i][0] == 2, "other heap changed", __LINE__);
+    expect(mm_heap_checkheap(heaps[1], __LINE__), "heap check failed",
+           __LINE__);
+    mm_heap_destroy(heaps[1]);
+
+    mm_free(own);
+    expect(mm_checkheap(__LINE__), "default heap check failed", __LINE__);
+}
+
+/* Where the shared test maps its heap, in both processes */
+#define SHARED_ADDR ((void *)0x600000000000UL)
+#define SHARED_BYTES (64UL << 20)
+#define SHARED_MESSAGE "from the creator"
+#define SHARED_REPLY "from the attached process"
+
+/*
+ * attach_shared - the exec'd side of test_shared: attaches the heap name,
+ *     checks the message at offset and leaves a reply as the user root.
+ *     Returns the exit status, 0 when everything worked.
+ */
+static int attach_shared(const char *name, size_t offset)
+{
+    mm_heap_t *heap = mm_heap_attach(name);
+    if (heap == NULL)
+        return 2;
+    if (strcmp(mm_heap_pointer(heap, offset), SHARED_MESSAGE) != 0)
+        return 3;
+    char *reply = mm_heap_malloc(heap, sizeof(SHARED_REPLY));
+    if (reply == NULL)
+        return 4;
+    strcpy(reply, SHARED_REPLY);
+    mm_heap_set_user_root(heap, reply);
+    mm_heap_free(heap, mm_heap_pointer(heap, offset));
+    bool ok = mm_heap_checkheap(heap, __LINE__);
+    mm_heap_destroy(heap);  /* detaches, the creator still has it */
+    return ok ? 0 : 5;
+}
+
+/*
+ * test_shared - a shared heap made at a fixed address can be attached by
+ *     a freshly exec'd process, whose own layout knows nothing of it, and
+ *     blocks handed over by offset work in both directions
+ */
+static void test_shared(void)
+{
+    char name[32];
+    char offset[32];
+    int status;
+
+    snprintf(name, sizeof(name), "/mmtest_%d", (int)getpid());
+    errno = 0;
+    expect(mm_heap_create_shared(name, SHARED_BYTES, NULL) == NULL && errno == EINVAL,
+           "made a shared heap without an address", __LINE__);
+
+    mm_heap_t *heap = mm_heap_create_shared(name, SHARED_BYTES, SHARED_ADDR);
+    expect(heap != NULL, "mm_heap_create_shared failed", __LINE__);
+    if (heap == NULL)
+        return;
+    char *message = mm_heap_malloc(heap, sizeof(SHARED_MESSAGE));
+    strcpy(message, SHARED_MESSAGE);
+    snprintf(offset, sizeof(offset), "%zu", mm_heap_offset(heap, message));
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl("/proc/self/exe", "mmtest", "--attach", name, offset, (char *)NULL);
+        _exit(1);
+    }
+    expect(pid > 0 && waitpid(pid, &status, 0) == pid, "fork failed", __LINE__);
+    expect(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+           "the exec'd process could not use the heap", __LINE__);
+
+    char *reply = mm_heap_user_root(heap);
+    expect(reply != NULL && strcmp(reply, SHARED_REPLY) == 0, "no reply", __LINE__);
+    if (reply != NULL)
+        mm_heap_free(heap, reply);
+    expect(mm_heap_checkheap(heap, __LINE__), "heap check failed", __LINE__);
+    mm_heap_destroy(heap);  /* the creator also unlinks the object */
+}
+
+/* A node of the list the persistent test keeps in its heap file */
+typedef struct node {
+    struct node *next;
+    size_t value;
+} node_t;
+
+/*
+ * test_persistent - a heap file reopens at the same address with its
+ *     blocks, user root and free lists intact, and files that do not
+ *     hold a heap are refused
+ */
+static void test_persistent(void)
+{
+    enum { NODES = 300, FILE_BYTES = 16 << 20 };
+    char path[64];
+    node_t *head = NULL;
+    node_t *node;
+    size_t value;
+    int i;
+
+    snprintf(path, sizeof(path), "/tmp/mmtest_%d.heap", (int)getpid());
+    unlink(path);
+    mm_heap_t *heap = mm_heap_open(path, FILE_BYTES, NULL);
+    expect(heap != NULL, "mm_heap_open failed to make the file", __LINE__);
+    if (heap == NULL)
+        return;
+    mm_heap_t *made = heap;
+    for (i = 0; i < NODES; i++) {
+        node = mm_heap_malloc(heap, sizeof(node_t) + (size_t)i % 200);
+        node->value = i;
+        node->next = head;
+        head = node;
+        if (i % 3 == 0)     /* leave some free blocks behind */
+            mm_heap_free(heap, mm_heap_malloc(heap, 64 + i));
+    }
+    mm_heap_set_user_root(heap, head);
+    mm_heap_destroy(heap);
+
+    heap = mm_heap_open(path, FILE_BYTES, NULL);
+    expect(heap == made, "reopened somewhere else", __LINE__);
+    if (heap != NULL) {
+        expect(mm_heap_checkheap(heap, __LINE__), "heap check failed", __LINE__);
+        head = mm_heap_user_root(heap);
+        value = NODES;
+        for (node = head; node != NULL; node = node->next)
+            expect(node->value == --value, "list changed", __LINE__);
+        expect(value == 0, "list cut short", __LINE__);
+
+        for (i = 0; i < NODES; i++)     /* the free lists still work */
+            mm_heap_free(heap, mm_heap_malloc(heap, 64 + i));
+        while (head != NULL) {
+            node = head->next;
+            mm_heap_free(heap, head);
+            head = node;
+        }
+        mm_heap_set_user_root(heap, NULL);
+        expect(mm_heap_checkheap(heap, __LINE__), "heap check failed", __LINE__);
+        mm_heap_destroy(heap);
+    }
+    unlink(path);
+
+    int fd = open(path, O_WRONLY | O_CREAT, 0600);   /* not a heap file */
+    expect(fd >= 0 && write(fd, "garbage", 7) == 7, "write failed", __LINE__);
+    close(fd);
+    errno = 0;
+    expect(mm_heap_open(path, FILE_BYTES, NULL) == NULL && errno == EINVAL,
+           "opened a file that holds no heap", __LINE__);
+    unlink(path);
+}
+
+/* The tests, in the order they run */
+static const struct {
+    const char *name;
+    void (*run)(void);
+} tests[] = {
+    { "span_release", test_span_release },
+    { "try_expand", test_try_expand },
+    { "batch", test_batch },
+    { "limits", test_limits },
+    { "region", test_region },
+    { "cache", test_cache },
+    { "heaps", test_heaps },
+    { "shared", test_shared },
+    { "persistent", test_persistent },
+};
+
+int main(int argc, char **argv)
+{
+    size_t t;
+    int failed = 0;
+    int i;
+
+    mem_init();
+    if (argc == 4 && strcmp(argv[1], "--attach") == 0)
+        return attach_shared(argv[2], strtoul(argv[3], NULL, 10));
+    for (t = 0; t < sizeof(tests) / sizeof(tests[0]); t++) {
+        bool selected = (argc == 1);
+        for (i = 1; i < argc; i++)
+            selected = selected || strcmp(argv[i], tests[t].name) == 0;
+        if (!selected)
+            continue;
+
+        test_name = tests[t].name;
+        test_failed = false;
+        tests[t].run();
+        printf("%-16s %s\n", tests[t].name, test_failed ? "FAILED" : "ok");
+        failed += test_failed;
+    }
+    mem_deinit();
+    return failed;
+}
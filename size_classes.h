@@ -0,0 +1,31 @@
+#ifndef __SIZE_CLASSES_H_
+#define __SIZE_CLASSES_H_
+
+/*
+ * size_classes.h - size-class table for mm.c
+ *
+ * Payload sizes up to SMALL_CLASS_MAX are mapped to a segregated list
+ * through class_index, indexed by size / 16. Larger sizes use
+ * LARGE_CLASSES_PER_POW2 classes per power of two, computed from the
+ * leading zero count, with the last class taking everything above
+ * 2^LARGE_CLASS_TOP_SHIFT.
+ *
+ * Default layout: exact classes every 16 bytes up to 256, then every
+ * 32 bytes up to 512 and every 64 bytes up to 1024 (32 classes).
+ */
+
+#define SMALL_CLASS_SHIFT 10
+#define SMALL_CLASS_MAX (1 << SMALL_CLASS_SHIFT)
+#define SMALL_CLASSES 32
+#define LARGE_CLASSES_PER_POW2 4
+#define LARGE_CLASS_TOP_SHIFT 16
+
+static const unsigned char class_index[SMALL_CLASS_MAX / 16 + 1] = {
+     0,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 16, 17, 17, 18, 18, 19, 19, 20, 20, 21, 21, 22, 22, 23,
+    23, 24, 24, 24, 24, 25, 25, 25, 25, 26, 26, 26, 26, 27, 27, 27,
+    27, 28, 28, 28, 28, 29, 29, 29, 29, 30, 30, 30, 30, 31, 31, 31,
+    31
+};
+
+#endif /* __SIZE_CLASSES_H_ */
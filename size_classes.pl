@@ -0,0 +1,191 @@
+#!/usr/bin/perl
+use Getopt::Std;
+
+##############################################################################
+#
+# This program builds the size-class table used by mm.c (size_classes.h)
+# from the allocation requests in one or more trace files. Sizes up to
+# SMALL_CLASS_MAX are split into a fixed number of classes so that the
+# expected internal fragmentation plus free-list search cost for the
+# observed size histogram is minimal. Without trace files it prints the
+# default table.
+#
+##############################################################################
+
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] [-n CLASSES] [-w WEIGHT] [-o OUTFILE] [TRACE ...]\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h               Print this message\n";
+    printf STDERR "  -n CLASSES       Number of table classes (default 32, at most 64)\n";
+    printf STDERR "  -w WEIGHT        Bytes of slack one extra list probe is worth (default 16)\n";
+    printf STDERR "  -o OUTFILE       Write the header to OUTFILE instead of stdout\n";
+    die "\n" ;
+}
+
+# Settings, these must agree with mm.c
+$align = 16;
+$small_shift = 10;
+$small_max = 1 << $small_shift;
+$nbins = $small_max / $align;     # bin i holds payload size i * 16
+
+getopts('hn:w:o:');
+
+if ($opt_h) {
+    usage($ARGV[0]);
+}
+
+$nclasses = $opt_n ? $opt_n : 32;
+$weight = defined($opt_w) ? $opt_w : 16;
+
+if ($nclasses < 1 || $nclasses > $nbins) {
+    usage("The number of classes must be between 1 and $nbins");
+}
+
+# Histogram of aligned request sizes, bins 1..$nbins
+@hist = (0) x ($nbins + 1);
+$requests = 0;
+
+foreach $trace (@ARGV) {
+    open(TRACE, "<", $trace) || die "Couldn't open trace file '$trace'\n";
+    $header = 0;
+    while (<TRACE>) {
+        foreach $word (split) {
+            push(@words, $word);
+        }
+        # the four header numbers: weight, ids, ops, data bytes
+        while ($header < 4 && @words) {
+            shift(@words);
+            $header++;
+        }
+        while (@words) {
+            last if (($words[0] =~ /^[ar]$/ && @words < 3) || ($words[0] =~ /^[mh]$/ && @words < 4)
+                     || ($words[0] eq "f" && @words < 2));
+            $op = shift(@words);
+            if ($op eq "a" || $op eq "r" || $op eq "m" || $op eq "h") {
+                shift(@words);
+                $size = shift(@words);
+                shift(@words) if ($op eq "m" || $op eq "h");  # the alignment or hint
+                $size = $align * int(($size + $align - 1) / $align);
+                $size = $align if ($size == 0);
+                if ($size <= $small_max) {
+                    $hist[$size / $align]++;
+                    $requests++;
+                }
+            } elsif ($op eq "f") {
+                shift(@words);
+            } else {
+                die "Bogus type '$op' in trace file '$trace'\n";
+            }
+        }
+    }
+    close(TRACE);
+}
+
+if ($requests == 0) {
+    # default layout: 16-byte steps up to 256, 32-byte steps up to 512, 64-byte steps up to 1024
+    @bounds = ();
+    for ($i = 1; $i <= 16; $i++) { push(@bounds, $i); }
+    for ($i = 18; $i <= 32; $i += 2) { push(@bounds, $i); }
+    for ($i = 36; $i <= 64; $i += 4) { push(@bounds, $i); }
+    $nclasses = @bounds;
+} else {
+    # cost of one class holding bins lo..hi: every request pays the slack up to the class's top
+    # size, plus WEIGHT for each smaller block of the same class it has to skip on average
+    sub class_cost {
+        my ($lo, $hi) = @_;
+        my ($count, $cost) = (0, 0);
+        for (my $i = $lo; $i <= $hi; $i++) {
+            $count += $hist[$i];
+        }
+        return 0 if ($count == 0);
+        my $below = 0;
+        for (my $i = $lo; $i <= $hi; $i++) {
+            $cost += $hist[$i] * ($hi - $i) * $align;
+            $cost += $weight * $hist[$i] * $below / $count;
+            $below += $hist[$i];
+        }
+        return $cost;
+    }
+
+    for ($lo = 1; $lo <= $nbins; $lo++) {
+        for ($hi = $lo; $hi <= $nbins; $hi++) {
+            $ccost[$lo][$hi] = class_cost($lo, $hi);
+        }
+    }
+
+    # best[k][i]: cheapest split of bins 1..i into k classes; from[k][i]: first bin of the last one
+    $best[0][0] = 0;
+    for ($i = 1; $i <= $nbins; $i++) {
+        $best[0][$i] = -1;
+    }
+    for ($k = 1; $k <= $nclasses; $k++) {
+        for ($i = 0; $i <= $nbins; $i++) {
+            $best[$k][$i] = -1;
+            for ($lo = $k; $lo <= $i; $lo++) {
+                next if ($best[$k - 1][$lo - 1] < 0);
+                $cost = $best[$k - 1][$lo - 1] + $ccost[$lo][$i];
+                if ($best[$k][$i] < 0 || $cost < $best[$k][$i]) {
+                    $best[$k][$i] = $cost;
+                    $from[$k][$i] = $lo;
+                }
+            }
+        }
+    }
+
+    @bounds = ();
+    for ($k = $nclasses, $i = $nbins; $k > 0; $k--) {
+        unshift(@bounds, $i);
+        $i = $from[$k][$i] - 1;
+    }
+}
+
+# class_index[i] is the class of payload size i * 16; size 0 shares class 0
+@index = (0);
+for ($class = 0, $i = 1; $i <= $nbins; $i++) {
+    $class++ if ($i > $bounds[$class]);
+    push(@index, $class);
+}
+
+if ($opt_o) {
+    open(OUT, ">", $opt_o) || die "Couldn't open output file '$opt_o'\n";
+} else {
+    open(OUT, ">&STDOUT");
+}
+
+print OUT "#ifndef __SIZE_CLASSES_H_\n";
+print OUT "#define __SIZE_CLASSES_H_\n\n";
+print OUT "/*\n";
+print OUT " * size_classes.h - size-class table for mm.c\n";
+print OUT " *\n";
+print OUT " * Payload sizes up to SMALL_CLASS_MAX are mapped to a segregated list\n";
+print OUT " * through class_index, indexed by size / 16. Larger sizes use\n";
+print OUT " * LARGE_CLASSES_PER_POW2 classes per power of two, computed from the\n";
+print OUT " * leading zero count, with the last class taking everything above\n";
+print OUT " * 2^LARGE_CLASS_TOP_SHIFT.\n";
+print OUT " *\n";
+if ($requests == 0) {
+    print OUT " * Default layout: exact classes every 16 bytes up to 256, then every\n";
+    print OUT " * 32 bytes up to 512 and every 64 bytes up to 1024 (32 classes).\n";
+} else {
+    print OUT " * Generated by size_classes.pl -n $nclasses -w $weight from $requests requests in:\n";
+    foreach $trace (@ARGV) {
+        print OUT " *   $trace\n";
+    }
+}
+print OUT " */\n\n";
+print OUT "#define SMALL_CLASS_SHIFT $small_shift\n";
+print OUT "#define SMALL_CLASS_MAX (1 << SMALL_CLASS_SHIFT)\n";
+print OUT "#define SMALL_CLASSES $nclasses\n";
+print OUT "#define LARGE_CLASSES_PER_POW2 4\n";
+print OUT "#define LARGE_CLASS_TOP_SHIFT 16\n\n";
+print OUT "static const unsigned char class_index[SMALL_CLASS_MAX / 16 + 1] = {\n";
+for ($i = 0; $i <= $nbins; $i += 16) {
+    $end = ($i + 16 <= $nbins) ? $i + 15 : $nbins;
+    print OUT "    ", join(", ", map { sprintf("%2d", $_) } @index[$i .. $end]);
+    print OUT ($end < $nbins) ? ",\n" : "\n";
+}
+print OUT "};\n\n";
+print OUT "#endif /* __SIZE_CLASSES_H_ */\n";
+close(OUT);